@@ -0,0 +1,519 @@
+#include "abi.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+enum class ArgClass {
+    None,
+    Integer,
+    Sse,
+    SseUp,
+    X87,
+    X87Up,
+    ComplexX87,
+    Memory,
+};
+
+const char* className(ArgClass argClass) {
+    switch (argClass) {
+        case ArgClass::None: return "NO_CLASS";
+        case ArgClass::Integer: return "INTEGER";
+        case ArgClass::Sse: return "SSE";
+        case ArgClass::SseUp: return "SSEUP";
+        case ArgClass::X87: return "X87";
+        case ArgClass::X87Up: return "X87UP";
+        case ArgClass::ComplexX87: return "COMPLEX_X87";
+        case ArgClass::Memory: return "MEMORY";
+    }
+    return "NO_CLASS";
+}
+
+enum class Convention {
+    SysV,
+    Aapcs64,
+    // Apple's arm64 variant, which passes every variadic argument on the stack and has long double be double.
+    Aapcs64Darwin,
+};
+
+// A scalar inside a type, at its byte offset from the start of the type.
+struct Leaf {
+    enum Kind {
+        Integer,
+        Float,
+        LongDouble,
+        Vector,
+    };
+
+    int64_t offset;
+    int64_t size;
+    Kind kind;
+};
+
+// Sizes of the Primitive names on the LP64 targets classified here, and whether they are floating point. long double
+// is the x87 80-bit format on x86-64 and IEEE quad precision on AArch64, 16 bytes either way, except on Apple's arm64
+// where TypeResolver takes it for double.
+struct PrimitiveInfo {
+    int64_t size;
+    Leaf::Kind kind;
+};
+
+const std::unordered_map<std::string, PrimitiveInfo>& primitives() {
+    static const std::unordered_map<std::string, PrimitiveInfo> table = {
+        {"bool", {1, Leaf::Integer}},
+        {"unsigned char", {1, Leaf::Integer}}, {"signed char", {1, Leaf::Integer}},
+        {"unsigned short", {2, Leaf::Integer}}, {"signed short", {2, Leaf::Integer}},
+        {"unsigned int", {4, Leaf::Integer}}, {"signed int", {4, Leaf::Integer}},
+        {"unsigned long", {8, Leaf::Integer}}, {"signed long", {8, Leaf::Integer}},
+        {"unsigned long long", {8, Leaf::Integer}}, {"signed long long", {8, Leaf::Integer}},
+        {"unsigned __int128", {16, Leaf::Integer}}, {"__int128", {16, Leaf::Integer}},
+        {"char16_t", {2, Leaf::Integer}}, {"char32_t", {4, Leaf::Integer}}, {"wchar_t", {4, Leaf::Integer}},
+        {"nullptr_t", {8, Leaf::Integer}},
+        {"half", {2, Leaf::Float}}, {"_Float16", {2, Leaf::Float}},
+        {"float", {4, Leaf::Float}}, {"double", {8, Leaf::Float}},
+        {"long double", {16, Leaf::LongDouble}}, {"__float128", {16, Leaf::Float}},
+    };
+    return table;
+}
+
+// Looks through type table IDs and typedef references to the type nodes they stand for, and up the structs they name.
+class TypeResolver {
+public:
+    TypeResolver(const json& out, bool longDoubleIsDouble)
+        : _types(section(out, "types")), _typedefs(section(out, "typedefs")), _structs(section(out, "structs")),
+          _longDoubleIsDouble(longDoubleIsDouble) {}
+
+    const json* resolve(const json& type) const {
+        const json* node = &type;
+        // Typedef chains are short; the bound only guards against malformed input.
+        for (int depth = 0; depth < 64; depth++) {
+            if (node->is_number_integer()) {
+                auto id = node->get<size_t>();
+                if (!_types || id >= _types->size()) return nullptr;
+                node = &(*_types)[id];
+                continue;
+            }
+            if (!node->is_object()) return nullptr;
+            if (node->value("kind", std::string()) != "Typedef") return node;
+
+            auto name = node->value("name", std::string());
+            if (!_typedefs || _typedefs->find(name) == _typedefs->end()) return nullptr;
+            node = &_typedefs->at(name);
+        }
+        return nullptr;
+    }
+
+    const json* record(const json& node) const {
+        if (!_structs) return nullptr;
+        auto it = _structs->find(node.value("name", std::string()));
+        return it == _structs->end() ? nullptr : &*it;
+    }
+
+    // The size and kind of a Primitive node, or null for names not in the table.
+    const PrimitiveInfo* primitive(const json& node) const {
+        static const PrimitiveInfo doubleInfo = {8, Leaf::Float};
+        auto name = node.value("name", std::string());
+        if (_longDoubleIsDouble && name == "long double") return &doubleInfo;
+        auto it = primitives().find(name);
+        return it == primitives().end() ? nullptr : &it->second;
+    }
+
+    // The type's size in bytes, or a negative number when it cannot be told.
+    int64_t size(const json& type) const {
+        auto node = resolve(type);
+        if (!node) return -1;
+
+        auto kind = node->value("kind", std::string());
+        if (kind == "Primitive") {
+            auto info = primitive(*node);
+            return info ? info->size : -1;
+        }
+        if (kind == "Pointer" || kind == "BlockPointer" || kind == "Reference" || kind == "RValueReference") return 8;
+        // The size of an enum follows its underlying type and packed attribute, so it is taken from the output.
+        if (kind == "Enum" || kind == "Atomic") return node->value("size", (int64_t)-1);
+        if (kind == "Struct") {
+            auto entry = record(*node);
+            return entry ? entry->value("size", (int64_t)-1) : -1;
+        }
+
+        auto element = node->find("elementType");
+        if (element == node->end()) return -1;
+        auto elementSize = size(*element);
+        if (elementSize < 0) return -1;
+        if (kind == "Complex") return 2 * elementSize;
+        if (kind == "Array") return node->value("size", (int64_t)0) * elementSize;
+        if (kind == "Vector") return node->value("lanes", (int64_t)0) * elementSize;
+        return -1;
+    }
+
+    // Appends the scalars making up the type, at offset. Returns false for types that cannot be resolved or are not
+    // passed by value, and sets unaligned for a field placed below its alignment.
+    bool leaves(const json& type, int64_t offset, std::vector<Leaf>& out, bool& unaligned) const {
+        auto node = resolve(type);
+        if (!node) return false;
+
+        auto kind = node->value("kind", std::string());
+        if (kind == "Primitive") {
+            auto info = primitive(*node);
+            if (!info) return false;
+            out.push_back({offset, info->size, info->kind});
+            return true;
+        }
+        if (kind == "Pointer" || kind == "BlockPointer" || kind == "Reference" || kind == "RValueReference" ||
+            kind == "Enum") {
+            auto bytes = size(*node);
+            if (bytes < 0) return false;
+            out.push_back({offset, bytes, Leaf::Integer});
+            return true;
+        }
+        if (kind == "Atomic") {
+            auto value = node->find("valueType");
+            if (value != node->end()) return leaves(*value, offset, out, unaligned);
+            out.push_back({offset, node->value("size", (int64_t)0), Leaf::Integer});
+            return true;
+        }
+        if (kind == "Vector") {
+            auto bytes = size(*node);
+            if (bytes <= 0) return false;
+            out.push_back({offset, bytes, Leaf::Vector});
+            return true;
+        }
+        if (kind == "Complex" || kind == "Array") {
+            auto element = node->find("elementType");
+            if (element == node->end()) return false;
+            auto elementSize = size(*element);
+            auto count = kind == "Complex" ? 2 : node->value("size", (int64_t)0);
+            if (elementSize < 0) return false;
+            for (int64_t i = 0; i < count; i++) {
+                if (!leaves(*element, offset + i * elementSize, out, unaligned)) return false;
+            }
+            return true;
+        }
+        if (kind == "Struct") {
+            auto entry = record(*node);
+            if (!entry) return false;
+            auto fields = entry->find("fields");
+            if (fields == entry->end()) return true;
+
+            for (auto& field : *fields) {
+                auto bitWidth = field.find("bitWidth");
+                if (bitWidth != field.end()) {
+                    // Only which eightbytes a bitfield touches matters, and unnamed zero-width ones touch none.
+                    auto width = bitWidth->get<int64_t>();
+                    if (width > 0) {
+                        auto bitOffset = field.value("bitOffset", (int64_t)0);
+                        out.push_back({offset + bitOffset / 8, (bitOffset % 8 + width + 7) / 8, Leaf::Integer});
+                    }
+                    continue;
+                }
+
+                auto fieldOffset = field.value("offset", (int64_t)0);
+                auto align = field.value("align", (int64_t)1);
+                if (align > 0 && fieldOffset % align != 0) unaligned = true;
+                // Flexible array members take no space.
+                if (field.value("size", (int64_t)0) <= 0) continue;
+                if (!leaves(field["type"], offset + fieldOffset, out, unaligned)) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static const json* section(const json& out, const char* name) {
+        auto it = out.find(name);
+        return it == out.end() ? nullptr : &*it;
+    }
+
+    const json* _types;
+    const json* _typedefs;
+    const json* _structs;
+    bool _longDoubleIsDouble;
+};
+
+bool isVoid(const json* node) {
+    return node && node->value("kind", std::string()) == "Primitive" && node->value("name", std::string()) == "void";
+}
+
+bool isAggregate(const json* node) {
+    auto kind = node->value("kind", std::string());
+    return kind == "Struct" || kind == "Complex";
+}
+
+// How one argument or return value is passed: a class per eightbyte (or per register on AArch64), or a single MEMORY.
+struct Classification {
+    std::vector<ArgClass> classes;
+
+    // Passed as a pointer to a caller made copy (AArch64 composites over 16 bytes).
+    bool byReference = false;
+
+    // 16-byte aligned values take an even-numbered register pair on AArch64.
+    bool evenPair = false;
+
+    bool inMemory() const {
+        return classes.size() == 1 && classes[0] == ArgClass::Memory;
+    }
+};
+
+ArgClass merge(ArgClass a, ArgClass b) {
+    if (a == b) return a;
+    if (a == ArgClass::None) return b;
+    if (b == ArgClass::None) return a;
+    if (a == ArgClass::Memory || b == ArgClass::Memory) return ArgClass::Memory;
+    if (a == ArgClass::Integer || b == ArgClass::Integer) return ArgClass::Integer;
+    if (a == ArgClass::X87 || a == ArgClass::X87Up || b == ArgClass::X87 || b == ArgClass::X87Up) return ArgClass::Memory;
+    return ArgClass::Sse;
+}
+
+// The SysV x86-64 classification algorithm (section 3.2.3 of the psABI).
+bool classifySysV(const TypeResolver& resolver, const json& type, Classification& out) {
+    auto node = resolver.resolve(type);
+    if (!node) return false;
+    if (isVoid(node)) return true;
+
+    // Anything over 16 bytes is passed in memory whatever it holds, except _Complex long double, which is COMPLEX_X87
+    // and returned in st0 and st1. Vectors that wide only go in registers with AVX, which the args do not tell.
+    auto size = resolver.size(*node);
+    if (size < 0) return false;
+    if (node->value("kind", std::string()) == "Complex") {
+        auto element = node->find("elementType");
+        auto elementNode = element == node->end() ? nullptr : resolver.resolve(*element);
+        if (elementNode && elementNode->value("kind", std::string()) == "Primitive" &&
+            elementNode->value("name", std::string()) == "long double") {
+            out.classes = {ArgClass::ComplexX87};
+            return true;
+        }
+    }
+    if (size > 16) {
+        out.classes = {ArgClass::Memory};
+        return true;
+    }
+
+    std::vector<Leaf> leaves;
+    bool unaligned = false;
+    if (!resolver.leaves(*node, 0, leaves, unaligned)) return false;
+    if (size == 0) return true;
+    if (unaligned) {
+        out.classes = {ArgClass::Memory};
+        return true;
+    }
+
+    std::vector<ArgClass> classes((size + 7) / 8, ArgClass::None);
+    for (auto& leaf : leaves) {
+        auto first = leaf.offset / 8;
+        auto last = std::min<int64_t>((leaf.offset + std::max<int64_t>(leaf.size, 1) - 1) / 8, (int64_t)classes.size() - 1);
+        for (auto i = first; i <= last; i++) {
+            ArgClass argClass;
+            switch (leaf.kind) {
+                case Leaf::Integer: argClass = ArgClass::Integer; break;
+                case Leaf::LongDouble: argClass = i == first ? ArgClass::X87 : ArgClass::X87Up; break;
+                default: argClass = i == first ? ArgClass::Sse : ArgClass::SseUp; break;
+            }
+            classes[i] = merge(classes[i], argClass);
+        }
+    }
+
+    for (size_t i = 0; i < classes.size(); i++) {
+        auto previous = i > 0 ? classes[i - 1] : ArgClass::None;
+        if (classes[i] == ArgClass::Memory || (classes[i] == ArgClass::X87Up && previous != ArgClass::X87)) {
+            out.classes = {ArgClass::Memory};
+            return true;
+        }
+        if (classes[i] == ArgClass::SseUp && previous != ArgClass::Sse && previous != ArgClass::SseUp) {
+            classes[i] = ArgClass::Sse;
+        }
+    }
+    out.classes = std::move(classes);
+    return true;
+}
+
+// The AAPCS64 rules (section 6.8 of the procedure call standard): homogeneous floating point and short vector
+// aggregates of up to four members go in SIMD and floating point registers, other composites of up to 16 bytes in
+// general registers, and larger ones by reference.
+bool classifyAapcs64(const TypeResolver& resolver, const json& type, Classification& out) {
+    auto node = resolver.resolve(type);
+    if (!node) return false;
+    if (isVoid(node)) return true;
+
+    // Nothing over four 16-byte members is homogeneous, so larger values are passed by reference whatever they hold.
+    auto size = resolver.size(*node);
+    if (size < 0) return false;
+    if (size > 64) {
+        out.classes = {ArgClass::Memory};
+        out.byReference = true;
+        return true;
+    }
+
+    std::vector<Leaf> leaves;
+    bool unaligned = false;
+    if (!resolver.leaves(*node, 0, leaves, unaligned)) return false;
+    if (size == 0) return true;
+
+    if (!isAggregate(node)) {
+        if (leaves.empty()) return false;
+        auto& leaf = leaves.front();
+        if (leaf.kind == Leaf::Vector && leaf.size != 8 && leaf.size != 16) {
+            out.classes = {ArgClass::Memory};
+            out.byReference = true;
+        } else if (leaf.kind == Leaf::Integer) {
+            out.classes.assign(size > 8 ? 2 : 1, ArgClass::Integer);
+            out.evenPair = size > 8;
+        } else {
+            out.classes = {ArgClass::Sse};
+        }
+        return true;
+    }
+
+    bool homogeneous = !leaves.empty() && leaves.size() <= 4;
+    for (auto& leaf : leaves) {
+        bool floating = leaf.kind != Leaf::Integer && (leaf.kind != Leaf::Vector || leaf.size == 8 || leaf.size == 16);
+        homogeneous = homogeneous && floating && leaf.kind == leaves[0].kind && leaf.size == leaves[0].size;
+    }
+    if (homogeneous) {
+        out.classes.assign(leaves.size(), ArgClass::Sse);
+    } else if (size > 16) {
+        out.classes = {ArgClass::Memory};
+        out.byReference = true;
+    } else {
+        auto record = node->value("kind", std::string()) == "Struct" ? resolver.record(*node) : nullptr;
+        out.classes.assign((size + 7) / 8, ArgClass::Integer);
+        out.evenPair = record && record->value("align", (int64_t)0) == 16;
+    }
+    return true;
+}
+
+json classesJson(const Classification& classification) {
+    json classes = json::array();
+    for (auto argClass : classification.classes) {
+        classes.push_back(className(argClass));
+    }
+    return classes;
+}
+
+// Classifies one function and assigns its arguments to registers in order, spilling the ones that no longer fit.
+bool classifyFunction(const TypeResolver& resolver, Convention convention, const json& function, json& abi) {
+    auto classify = convention == Convention::SysV ? classifySysV : classifyAapcs64;
+    size_t intRegs = convention == Convention::SysV ? 6 : 8;
+    size_t sseRegs = 8;
+
+    Classification result;
+    auto returnType = function.find("returnType");
+    if (returnType == function.end() || !classify(resolver, *returnType, result)) return false;
+
+    abi = json::object();
+    switch (convention) {
+        case Convention::SysV: abi["convention"] = "sysv-x86-64"; break;
+        case Convention::Aapcs64: abi["convention"] = "aapcs64"; break;
+        case Convention::Aapcs64Darwin: abi["convention"] = "aapcs64-darwin"; break;
+    }
+
+    // A value returned in memory is written through a pointer the caller passes: in the first integer register on
+    // x86-64, and in x8, which is not an argument register, on AArch64.
+    bool sret = result.inMemory() || result.byReference;
+    if (sret) {
+        abi["return"] = {{"class", {className(ArgClass::Memory)}}};
+        abi["sret"] = true;
+        if (convention == Convention::SysV) intRegs--;
+    } else {
+        abi["return"] = {{"class", classesJson(result)}};
+    }
+
+    size_t usedInt = 0;
+    size_t usedSse = 0;
+    json args = json::array();
+    auto argTypes = function.find("argTypes");
+    if (argTypes != function.end()) {
+        for (auto& argType : *argTypes) {
+            Classification arg;
+            if (!classify(resolver, argType, arg)) return false;
+
+            // x87 values are returned in registers but always passed in memory.
+            for (auto argClass : arg.classes) {
+                if (argClass == ArgClass::X87 || argClass == ArgClass::X87Up || argClass == ArgClass::ComplexX87) {
+                    arg.classes = {ArgClass::Memory};
+                }
+            }
+
+            json entry;
+            if (arg.byReference) {
+                // The pointer to the copy is passed like any other pointer.
+                entry["class"] = {className(ArgClass::Memory)};
+                entry["byReference"] = true;
+                if (usedInt < intRegs) usedInt++;
+                args.push_back(std::move(entry));
+                continue;
+            }
+
+            auto needInt = (size_t)std::count(arg.classes.begin(), arg.classes.end(), ArgClass::Integer);
+            auto needSse = (size_t)std::count(arg.classes.begin(), arg.classes.end(), ArgClass::Sse);
+            auto firstInt = usedInt + (arg.evenPair && usedInt % 2 != 0 ? 1 : 0);
+            if (arg.inMemory() || firstInt + needInt > intRegs || usedSse + needSse > sseRegs) {
+                // On AArch64 an argument that does not fit closes its register file to every later argument.
+                if (convention != Convention::SysV && needInt > 0) usedInt = intRegs;
+                if (convention != Convention::SysV && needSse > 0) usedSse = sseRegs;
+                entry["class"] = {className(ArgClass::Memory)};
+            } else {
+                if (needInt > 0) usedInt = firstInt + needInt;
+                usedSse += needSse;
+                entry["class"] = classesJson(arg);
+            }
+            args.push_back(std::move(entry));
+        }
+    }
+    abi["args"] = std::move(args);
+
+    // SysV callers of a variadic function also pass the number of vector registers used in al. On Apple's arm64 the
+    // variadic arguments skip the registers left over and all go on the stack.
+    if (function.value("varadic", false)) {
+        abi["varargs"] = true;
+        if (convention == Convention::Aapcs64Darwin) abi["varargsOnStack"] = true;
+    }
+    return true;
+}
+
+}
+
+bool abiTarget(const json& out, std::string& triple) {
+    auto targets = out.find("targets");
+    if (targets == out.end() || !targets->is_object() || targets->size() != 1) return false;
+    triple = targets->begin().key();
+    return true;
+}
+
+bool classifyCalls(json& out, const std::string& triple, size_t& unclassified) {
+    Convention convention;
+    // x32 is x86-64 with 32-bit pointers and longs, which the primitive sizes here do not cover.
+    bool x32 = triple.find("gnux32") != std::string::npos;
+    if (triple.rfind("x86_64", 0) == 0 && triple.find("windows") == std::string::npos && !x32) {
+        convention = Convention::SysV;
+    } else if ((triple.rfind("aarch64", 0) == 0 || triple.rfind("arm64", 0) == 0) &&
+               triple.find("windows") == std::string::npos) {
+        bool darwin = triple.find("-apple-") != std::string::npos || triple.find("darwin") != std::string::npos;
+        convention = darwin ? Convention::Aapcs64Darwin : Convention::Aapcs64;
+    } else {
+        return false;
+    }
+
+    unclassified = 0;
+    auto vars = out.find("vars");
+    if (vars == out.end()) return true;
+
+    TypeResolver resolver(out, convention == Convention::Aapcs64Darwin);
+    for (auto& function : *vars) {
+        // Functions declared with another convention, like __attribute__((ms_abi)), are left alone.
+        auto callingConv = function.value("callingConv", std::string("C"));
+        if (callingConv != "C" && callingConv != (convention == Convention::SysV ? "X86_64SysV" : "C")) {
+            unclassified++;
+            continue;
+        }
+
+        json abi;
+        if (classifyFunction(resolver, convention, function, abi)) {
+            function["abi"] = std::move(abi);
+        } else {
+            unclassified++;
+        }
+    }
+    return true;
+}
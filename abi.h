@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include "model.h"
+
+// The target triple out's units were parsed for, from its targets section. Returns false when it records none, or
+// several because units were built for different targets.
+bool abiTarget(const json& out, std::string& triple);
+
+// Adds to every function in out's vars how the target's C calling convention passes it: the SysV x86-64 classes
+// (INTEGER, SSE, SSEUP, X87, X87UP, COMPLEX_X87, MEMORY) of each eightbyte of every argument and of the return value,
+// whether the return value goes through a hidden sret pointer, and whether the function takes varargs. On AArch64 the
+// same classes describe AAPCS64, with SSE standing for a SIMD and floating point register, and Apple arm64 targets
+// additionally mark variadic functions varargsOnStack. Functions whose types cannot all be resolved, such as ones
+// passing unions, are left without a classification and counted in unclassified. Returns false when the target is
+// neither LP64 x86-64 nor AArch64 outside Windows.
+bool classifyCalls(json& out, const std::string& triple, size_t& unclassified);
@@ -0,0 +1,65 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static constexpr size_t chunkSize = 256 << 10;
+
+namespace {
+
+// Owns every arena and chunk until exit. Arenas outlive their threads because worker results are merged on the main
+// thread after the workers are gone.
+struct ArenaRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Arena>> arenas;
+    std::vector<void*> chunks;
+
+    ~ArenaRegistry() {
+        for (auto chunk : chunks) {
+            std::free(chunk);
+        }
+    }
+
+    static ArenaRegistry& get() {
+        static ArenaRegistry registry;
+        return registry;
+    }
+};
+
+}
+
+Arena* Arena::acquire() {
+    auto& registry = ArenaRegistry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.arenas.push_back(std::make_unique<Arena>());
+    return registry.arenas.back().get();
+}
+
+Arena::Counters Arena::counters() {
+    auto& registry = ArenaRegistry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    Counters total;
+    total.chunks = registry.chunks.size();
+    for (auto& arena : registry.arenas) {
+        total.bumps += arena->_counters.bumps;
+        total.reuses += arena->_counters.reuses;
+    }
+    return total;
+}
+
+void Arena::refill() {
+    auto chunk = static_cast<char*>(std::malloc(chunkSize));
+    if (chunk == nullptr) throw std::bad_alloc();
+
+    auto& registry = ArenaRegistry::get();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.chunks.push_back(chunk);
+    }
+
+    // Whatever is left of the old chunk is too small for this request, so it is simply abandoned.
+    _cursor = chunk;
+    _end = chunk + chunkSize;
+}
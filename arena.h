@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Per-thread bump allocator with size-class free lists, backing the json model. Chunks are never returned to the
+// system while the process runs, so values can move freely between threads; the whole arena is released in one go at
+// exit instead of node by node.
+class Arena {
+public:
+    static constexpr size_t granularity = 16;
+    static constexpr size_t maxSmallSize = 1024;
+
+    // What every arena allocated so far, for the benchmark. Neither chunks nor blocks go through operator new.
+    struct Counters {
+        uint64_t chunks = 0;
+        uint64_t bumps = 0;
+        uint64_t reuses = 0;
+    };
+
+    // Sums the counters of every thread's arena. Only exact once the threads allocating from them were joined.
+    static Counters counters();
+
+    // The calling thread's arena.
+    static Arena& local() {
+        static thread_local Arena* arena = acquire();
+        return *arena;
+    }
+
+    void* allocate(size_t size) {
+        auto sizeClass = classOf(size);
+        if (auto block = _freeLists[sizeClass]) {
+            _freeLists[sizeClass] = block->next;
+            _counters.reuses++;
+            return block;
+        }
+        _counters.bumps++;
+
+        auto rounded = (sizeClass + 1) * granularity;
+        if (_end - _cursor < (ptrdiff_t)rounded) {
+            refill();
+        }
+
+        auto result = _cursor;
+        _cursor += rounded;
+        return result;
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        auto block = static_cast<FreeBlock*>(ptr);
+        auto sizeClass = classOf(size);
+        block->next = _freeLists[sizeClass];
+        _freeLists[sizeClass] = block;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t classOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    static Arena* acquire();
+    void refill();
+
+    char* _cursor = nullptr;
+    char* _end = nullptr;
+    Counters _counters;
+    FreeBlock* _freeLists[maxSmallSize / granularity] = {};
+};
+
+// Stateless allocator over the calling thread's Arena. Large blocks (long arrays) bypass the arena.
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        auto size = n * sizeof(T);
+        if (alignof(T) > Arena::granularity || size > Arena::maxSmallSize) {
+            return static_cast<T*>(::operator new(size));
+        }
+        return static_cast<T*>(Arena::local().allocate(size));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        auto size = n * sizeof(T);
+        if (alignof(T) > Arena::granularity || size > Arena::maxSmallSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        Arena::local().deallocate(ptr, size);
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>&) const noexcept {
+        return false;
+    }
+};
@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "bindgen.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+// Every heap allocation the process makes, counted by the replaced global operator new below. Allocations libclang makes
+// with malloc are not included.
+static std::atomic<uint64_t> allocationCount{0};
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Allocations made by each run: operator new calls, plus the json nodes the arenas hand out, which never reach operator
+// new. Arena blocks are either bumped off a chunk or reused from a free list, and chunks come from malloc.
+class AllocationCounts {
+public:
+    void start() {
+        _heap = allocationCount.load();
+        _arena = Arena::counters();
+    }
+
+    void stop() {
+        auto arena = Arena::counters();
+        _heapRuns.push_back(double(allocationCount.load() - _heap));
+        _bumpRuns.push_back(double(arena.bumps - _arena.bumps));
+        _reuseRuns.push_back(double(arena.reuses - _arena.reuses));
+        _chunkRuns.push_back(double(arena.chunks - _arena.chunks));
+    }
+
+    void print() const;
+
+private:
+    uint64_t _heap = 0;
+    Arena::Counters _arena;
+    std::vector<double> _heapRuns, _bumpRuns, _reuseRuns, _chunkRuns;
+};
+
+// Shape of the synthetic header. Every struct gets its own typedef chain, function pointer chain, enum and nested
+// struct chain so the generated declarations do not collapse onto a few shared types.
+struct HeaderParams {
+    unsigned structs = 1000;
+    unsigned fields = 8;
+    unsigned depth = 2;
+    unsigned typedefDepth = 3;
+    unsigned fnPtrDepth = 2;
+    unsigned enumSize = 16;
+    unsigned constGlobals = 100;
+};
+
+std::string generateHeader(const HeaderParams& params) {
+    std::ostringstream out;
+    out << "// Generated by nativebindgen_bench\n\n";
+
+    for (unsigned i = 0; i < params.structs; i++) {
+        out << "typedef int t" << i << "_0;\n";
+        for (unsigned d = 1; d < params.typedefDepth; d++) {
+            out << "typedef t" << i << "_" << d - 1 << " t" << i << "_" << d << ";\n";
+        }
+        auto typedefName = "t" + std::to_string(i) + "_" + std::to_string(std::max(1u, params.typedefDepth) - 1);
+        if (params.typedefDepth == 0) typedefName = "int";
+
+        // Each function pointer takes and returns the previous one.
+        out << "typedef int (*fp" << i << "_0)(int, const char*);\n";
+        for (unsigned d = 1; d < params.fnPtrDepth; d++) {
+            out << "typedef fp" << i << "_" << d - 1 << " (*fp" << i << "_" << d << ")(fp" << i << "_" << d - 1
+                << ", void*);\n";
+        }
+        auto fnPtrName = "fp" + std::to_string(i) + "_" + std::to_string(std::max(1u, params.fnPtrDepth) - 1);
+        if (params.fnPtrDepth == 0) fnPtrName = "void*";
+
+        if (params.enumSize > 0) {
+            out << "enum e" << i << " {";
+            for (unsigned e = 0; e < params.enumSize; e++) {
+                out << (e ? ", " : " ") << "E" << i << "_" << e << " = " << e;
+            }
+            out << " };\n";
+        }
+
+        // Innermost struct first, each level embeds the one below it.
+        for (unsigned d = params.depth; d-- > 0;) {
+            out << "struct s" << i << "_" << d << " {\n";
+            for (unsigned f = 0; f < params.fields; f++) {
+                out << "    ";
+                switch (f % 6) {
+                    case 0: out << "int"; break;
+                    case 1: out << "double"; break;
+                    case 2: out << "const char*"; break;
+                    case 3: out << typedefName; break;
+                    case 4: out << fnPtrName; break;
+                    case 5: out << "unsigned char"; break;
+                }
+                out << " f" << f << (f % 6 == 5 ? "[16]" : "") << ";\n";
+            }
+            if (d + 1 < params.depth) {
+                out << "    struct s" << i << "_" << d + 1 << " nested;\n";
+            }
+            if (params.enumSize > 0) {
+                out << "    enum e" << i << " kind;\n";
+            }
+            out << "};\n";
+        }
+
+        if (params.depth > 0) {
+            out << "int fn" << i << "(struct s" << i << "_0* self, " << fnPtrName << " callback, " << typedefName
+                << " value);\n";
+        }
+        out << "\n";
+    }
+
+    for (unsigned c = 0; c < params.constGlobals; c++) {
+        switch (c % 3) {
+            case 0: out << "static const int c" << c << " = " << c << " * 3 + 1;\n"; break;
+            case 1: out << "static const double c" << c << " = " << c << ".5;\n"; break;
+            case 2: out << "static const char* const c" << c << " = \"const" << c << "\";\n"; break;
+        }
+    }
+
+    return out.str();
+}
+
+struct Summary {
+    double min, median, p90, p99, max, mean;
+};
+
+static Summary summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        // Nearest rank percentile.
+        auto rank = (size_t)std::ceil(q * samples.size());
+        return samples[std::min(samples.size() - 1, rank == 0 ? 0 : rank - 1)];
+    };
+
+    double sum = 0;
+    for (auto sample : samples) sum += sample;
+    return {samples.front(), at(0.5), at(0.9), at(0.99), samples.back(), sum / samples.size()};
+}
+
+static void printColumns(unsigned runs) {
+    cout << runs << " runs, wall ms" << endl;
+    cout << std::left << std::setw(12) << "phase" << std::right;
+    for (auto column : {"min", "median", "p90", "p99", "max", "mean"}) {
+        cout << std::setw(11) << column;
+    }
+    cout << endl;
+}
+
+static void printRow(const char* name, const std::vector<double>& values) {
+    auto summary = summarize(values);
+    cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3);
+    for (auto value : {summary.min, summary.median, summary.p90, summary.p99, summary.max, summary.mean}) {
+        cout << std::setw(11) << value;
+    }
+    cout << endl;
+}
+
+// Type nodes spelled the way the extractor spells them, for an LP64 target.
+static json primitive(const char* name) {
+    return {{"kind", "Primitive"}, {"name", name}};
+}
+
+static json pointer(json pointee) {
+    return {{"kind", "Pointer"}, {"pointee", std::move(pointee)}};
+}
+
+static json function(json argTypes, json returnType) {
+    return {{"kind", "Function"}, {"argTypes", std::move(argTypes)}, {"returnType", std::move(returnType)}};
+}
+
+static json srcRef(unsigned line) {
+    return {{"fileName", "/tmp/nativebindgen_bench_XXXXXX.h"}, {"line", line}, {"col", 8}, {"offset", line * 32}};
+}
+
+static int64_t alignUp(int64_t value, int64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// The document extraction produces for the generated header, built straight from params with the same lookup pattern
+// typeVisitor uses (a section, then a name, then a key, for every value). It times the json model on its own, without
+// libclang, so builds with and without NATIVEBINDGEN_STD_JSON can be compared on any host. Typedefs are referenced by
+// name with --typedefs and expanded otherwise, as extraction does.
+static json buildModel(const HeaderParams& params, const Options& options) {
+    json info;
+    // Past the comment and blank line generateHeader starts with.
+    unsigned line = 3;
+    for (unsigned i = 0; i < params.structs; i++) {
+        auto prefix = std::to_string(i);
+
+        // Declared whether or not anything uses them, but only the ones a declaration refers to are dumped.
+        bool used = params.depth > 0 && options.typedefRefs;
+        json typedefType = primitive("signed int");
+        for (unsigned d = 0; used && d < params.typedefDepth; d++) {
+            auto name = "t" + prefix + "_" + std::to_string(d);
+            info["typedefs"][name] = typedefType;
+            typedefType = {{"kind", "Typedef"}, {"name", name}};
+        }
+        json fnPtrType = pointer(primitive("void"));
+        for (unsigned d = 0; d < params.fnPtrDepth; d++) {
+            json argTypes = json::array();
+            json returnType = primitive("signed int");
+            if (d == 0) {
+                argTypes.push_back(primitive("signed int"));
+                argTypes.push_back(pointer(primitive("signed char")));
+            } else {
+                argTypes.push_back(fnPtrType);
+                argTypes.push_back(pointer(primitive("void")));
+                returnType = fnPtrType;
+            }
+            auto type = pointer(function(std::move(argTypes), std::move(returnType)));
+            if (!options.typedefRefs) {
+                fnPtrType = std::move(type);
+                continue;
+            }
+            auto name = "fp" + prefix + "_" + std::to_string(d);
+            if (used) info["typedefs"][name] = std::move(type);
+            fnPtrType = {{"kind", "Typedef"}, {"name", name}};
+        }
+        line += std::max(1u, params.typedefDepth) + std::max(1u, params.fnPtrDepth);
+
+        json enumType = {{"kind", "Enum"}, {"name", "e" + prefix}, {"size", 4}};
+        if (params.enumSize > 0) {
+            for (unsigned e = 0; e < params.enumSize; e++) {
+                auto name = "E" + prefix + "_" + std::to_string(e);
+                info["constants"][name]["type"] = enumType;
+                info["constants"][name]["value"] = e;
+                info["srcRefs"][name] = srcRef(line);
+            }
+            line++;
+        }
+
+        // Innermost struct first, each level embeds the one below it.
+        int64_t nestedSize = 0;
+        int64_t nestedAlign = 1;
+        for (unsigned d = params.depth; d-- > 0;) {
+            auto name = "s" + prefix + "_" + std::to_string(d);
+            json fields = json::array();
+            int64_t offset = 0;
+            int64_t align = 1;
+            auto addField = [&](std::string fieldName, int64_t size, int64_t fieldAlign, json type) {
+                offset = alignUp(offset, fieldAlign);
+                fields.push_back({
+                    {"size", size}, {"align", fieldAlign}, {"offset", offset}, {"name", std::move(fieldName)},
+                    {"type", std::move(type)},
+                });
+                offset += size;
+                align = std::max(align, fieldAlign);
+            };
+            for (unsigned f = 0; f < params.fields; f++) {
+                auto fieldName = "f" + std::to_string(f);
+                switch (f % 6) {
+                    case 0: addField(fieldName, 4, 4, primitive("signed int")); break;
+                    case 1: addField(fieldName, 8, 8, primitive("double")); break;
+                    case 2: addField(fieldName, 8, 8, pointer(primitive("signed char"))); break;
+                    case 3: addField(fieldName, 4, 4, typedefType); break;
+                    case 4: addField(fieldName, 8, 8, fnPtrType); break;
+                    case 5:
+                        addField(fieldName, 16, 1, {
+                            {"kind", "Array"}, {"elementType", primitive("unsigned char")}, {"size", 16},
+                        });
+                        break;
+                }
+            }
+            if (d + 1 < params.depth) {
+                auto nested = "s" + prefix + "_" + std::to_string(d + 1);
+                addField("nested", nestedSize, nestedAlign, {{"kind", "Struct"}, {"name", nested}});
+            }
+            if (params.enumSize > 0) {
+                addField("kind", 4, 4, enumType);
+            }
+
+            nestedSize = alignUp(offset, align);
+            nestedAlign = align;
+            info["structs"][name]["size"] = nestedSize;
+            info["structs"][name]["align"] = align;
+            info["structs"][name]["fields"] = std::move(fields);
+            info["srcRefs"][name] = srcRef(line);
+            line += params.fields + (d + 1 < params.depth) + (params.enumSize > 0) + 2;
+        }
+
+        if (params.depth > 0) {
+            auto name = "fn" + prefix;
+            info["vars"][name]["argTypes"] = json::array();
+            info["vars"][name]["argTypes"].push_back(pointer({{"kind", "Struct"}, {"name", "s" + prefix + "_0"}}));
+            info["vars"][name]["argTypes"].push_back(fnPtrType);
+            info["vars"][name]["argTypes"].push_back(typedefType);
+            info["vars"][name]["returnType"] = primitive("signed int");
+            info["srcRefs"][name] = srcRef(line++);
+        }
+        line++;
+    }
+
+    for (unsigned c = 0; c < params.constGlobals; c++) {
+        auto name = "c" + std::to_string(c);
+        switch (c % 3) {
+            case 0:
+                info["constants"][name]["type"] = primitive("signed int");
+                info["constants"][name]["value"] = (int64_t)c * 3 + 1;
+                break;
+            case 1:
+                info["constants"][name]["type"] = primitive("double");
+                info["constants"][name]["value"] = c + 0.5;
+                break;
+            case 2:
+                info["constants"][name]["type"] = pointer(primitive("signed char"));
+                info["constants"][name]["value"] = "const" + std::to_string(c);
+                break;
+        }
+        info["srcRefs"][name] = srcRef(line++);
+    }
+    return info;
+}
+
+// Times building the model document and serializing it, runs times after a warm-up run.
+static int benchModel(const HeaderParams& params, const Options& options, unsigned runs) {
+    int nullFd = open("/dev/null", O_WRONLY);
+    std::vector<double> builds, serializes, totals;
+    AllocationCounts allocations;
+    size_t bytes = 0;
+
+    for (unsigned run = 0; run <= runs; run++) {
+        allocations.start();
+        auto start = std::chrono::steady_clock::now();
+        auto info = buildModel(params, options);
+        auto built = std::chrono::steady_clock::now();
+
+        {
+            OutputSink sink({nullFd});
+            writeValue(sink, info, options.format);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        // The warm-up run measures the output size instead, which must match between the two models.
+        if (run == 0) {
+            std::string encoded;
+            OutputSink sink(encoded);
+            writeValue(sink, info, options.format);
+            sink.flush();
+            bytes = encoded.size();
+            continue;
+        }
+
+        builds.push_back(std::chrono::duration<double, std::milli>(built - start).count());
+        serializes.push_back(std::chrono::duration<double, std::milli>(end - built).count());
+        totals.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        allocations.stop();
+    }
+    close(nullFd);
+
+#ifdef NATIVEBINDGEN_STD_JSON
+    const char* model = "nlohmann::json";
+#else
+    const char* model = "flat map + arena";
+#endif
+    cout << "model: " << model << ", " << params.structs << " structs, " << params.fields << " fields, depth "
+         << params.depth << " (" << bytes << " bytes of " << outputExtension(options.format) << ")" << endl;
+    printColumns(runs);
+    printRow("build", builds);
+    printRow("serialize", serializes);
+    printRow("total", totals);
+    allocations.print();
+    return 0;
+}
+
+void AllocationCounts::print() const {
+    cout << std::setprecision(0) << "allocations per run (median, min, max):" << endl;
+    auto printCounts = [](const char* name, const std::vector<double>& values) {
+        auto summary = summarize(values);
+        cout << "  " << std::left << std::setw(20) << name << std::right << std::setw(11) << summary.median
+             << std::setw(11) << summary.min << std::setw(11) << summary.max << endl;
+    };
+    printCounts("operator new", _heapRuns);
+    printCounts("arena bumped", _bumpRuns);
+    printCounts("arena reused", _reuseRuns);
+    printCounts("arena chunks", _chunkRuns);
+}
+
+void usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " [--structs N] [--fields N] [--depth N] [--typedef-depth N] [--fnptr-depth N]"
+         << " [--enum-size N] [--consts N] [--runs N] [--prune] [--type-table] [--file-table] [--typedefs] [--macros]"
+         << " [--format json|cbor|msgpack|ubjson|bson] [--emit-header] [--model] [-I<dir>] [-D<macro>]" << endl;
+}
+
+int main(int argc, char** argv) {
+    HeaderParams params;
+    Options options;
+    unsigned runs = 10;
+    bool emitHeader = false;
+    bool model = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() { return (unsigned)std::strtoul(argv[++i], nullptr, 10); };
+        bool hasValue = i + 1 < argc;
+        if (arg == "--structs" && hasValue) {
+            params.structs = next();
+        } else if (arg == "--fields" && hasValue) {
+            params.fields = next();
+        } else if (arg == "--depth" && hasValue) {
+            params.depth = next();
+        } else if (arg == "--typedef-depth" && hasValue) {
+            params.typedefDepth = next();
+        } else if (arg == "--fnptr-depth" && hasValue) {
+            params.fnPtrDepth = next();
+        } else if (arg == "--enum-size" && hasValue) {
+            params.enumSize = next();
+        } else if (arg == "--consts" && hasValue) {
+            params.constGlobals = next();
+        } else if (arg == "--runs" && hasValue) {
+            runs = std::max(1u, next());
+        } else if (arg == "--prune") {
+            options.prune = true;
+        } else if (arg == "--typedefs") {
+            options.typedefRefs = true;
+        } else if (arg == "--macros") {
+            options.macros = true;
+        } else if (arg == "--file-table") {
+            options.fileTable = true;
+        } else if (arg == "--type-table") {
+            options.typeTable = true;
+        } else if (arg == "--format" && hasValue) {
+            if (!parseOutputFormat(argv[++i], options.format)) {
+                cerr << "Unknown output format " << argv[i] << endl;
+                return -1;
+            }
+        } else if (arg == "--emit-header") {
+            emitHeader = true;
+        } else if (arg == "--model") {
+            model = true;
+        } else if (arg.rfind("-I", 0) == 0 || arg.rfind("-D", 0) == 0) {
+            options.clangArgs.push_back(arg);
+        } else {
+            usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : -1;
+        }
+    }
+
+    if (model) {
+        return benchModel(params, options, runs);
+    }
+
+    auto header = generateHeader(params);
+    if (emitHeader) {
+        cout << header;
+        return 0;
+    }
+
+    char headerPath[] = "/tmp/nativebindgen_bench_XXXXXX.h";
+    int headerFd = mkstemps(headerPath, 2);
+    if (headerFd < 0 || write(headerFd, header.data(), header.size()) != (ssize_t)header.size()) {
+        cerr << "Unable to write " << headerPath << endl;
+        return -1;
+    }
+    close(headerFd);
+
+    options.headers = {headerPath};
+    options.jobs = 1;
+    options.stats = true;
+
+    int nullFd = open("/dev/null", O_WRONLY);
+    std::vector<double> samples[phaseCount];
+    std::vector<double> totals;
+    AllocationCounts allocations;
+
+    // The first run only warms up the page cache and allocator.
+    for (unsigned run = 0; run <= runs; run++) {
+        Stats stats;
+        StatsScope statsScope(&stats);
+        auto start = std::chrono::steady_clock::now();
+        allocations.start();
+
+        TypeTable types;
+        FileTable files;
+        auto results = extractHeaders(options, nullptr, nullptr, &types, &files);
+
+        json out;
+        for (auto& result : results) {
+            if (!result.ok) {
+                cerr << result.diagnostics;
+                unlink(headerPath);
+                return -1;
+            }
+            stats.merge(result.stats);
+            mergeTypes(types, result.info);
+            mergeFiles(files, result.info);
+            mergeInfo(out, result.info);
+        }
+        if (options.typeTable) {
+            out["types"] = std::move(types.entries);
+        }
+        if (options.fileTable) {
+            out["files"] = std::move(files.entries);
+        }
+
+        {
+            OutputSink sink({nullFd});
+            writeValue(sink, out, options.format);
+        }
+
+        auto total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0) continue;
+
+        for (size_t phase = 0; phase < phaseCount; phase++) {
+            samples[phase].push_back(stats.phases[phase].wallMs);
+        }
+        totals.push_back(total);
+        allocations.stop();
+    }
+
+    close(nullFd);
+    unlink(headerPath);
+
+    cout << "header: " << params.structs << " structs, " << params.fields << " fields, depth " << params.depth
+         << ", typedef depth " << params.typedefDepth << ", fnptr depth " << params.fnPtrDepth << ", enum size "
+         << params.enumSize << ", " << params.constGlobals << " consts (" << header.size() << " bytes)" << endl;
+    printColumns(runs);
+
+    for (size_t phase = 0; phase < phaseCount; phase++) {
+        printRow(phaseName((Phase)phase), samples[phase]);
+    }
+    printRow("total", totals);
+    allocations.print();
+
+    return 0;
+}
@@ -0,0 +1,1994 @@
+#include "bindgen.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <unordered_set>
+#include <clang-c/CXCompilationDatabase.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "exports.h"
+
+using std::cerr;
+using std::endl;
+
+// Names are copied once, straight into the std::string that ends up in the json model.
+std::string getTypeSpelling(CXType type) {
+    ClangString displayName(clang_getCursorDisplayName(clang_getTypeDeclaration(type)));
+    if (!displayName.view().empty()) return displayName.str();
+    return ClangString(clang_getTypeSpelling(type)).str();
+}
+
+std::string getTypedefName(CXType type) {
+    return ClangString(clang_getTypedefName(type)).str();
+}
+
+std::string getCursorSpelling(CXCursor cursor) {
+    return ClangString(clang_getCursorSpelling(cursor)).str();
+}
+
+static bool isAnonymousType(CXCursor cursor)  {
+    if (clang_Cursor_isAnonymous(cursor)) return true;
+
+    // Only searched, so the spelling is borrowed rather than copied.
+    auto type = clang_getCursorType(cursor);
+    ClangString displayName(clang_getCursorDisplayName(clang_getTypeDeclaration(type)));
+    if (!displayName.view().empty()) {
+        return displayName.view().find("::(anonymous") != std::string_view::npos;
+    }
+    return ClangString(clang_getTypeSpelling(type)).view().find("::(anonymous") != std::string_view::npos;
+}
+
+// The byte holding the field's first bit, or the negative CXTypeLayoutError libclang reported.
+int64_t getOffsetOfFieldInBytes(CXCursor cursor) {
+    auto offset = clang_Cursor_getOffsetOfField(cursor);
+    return offset < 0 ? offset : offset / 8;
+}
+
+// What libclang's target info tells about the unit's target.
+struct UnitTarget {
+    std::string triple;
+    int64_t pointerWidth;
+};
+
+static UnitTarget unitTarget(CXTranslationUnit unit) {
+    auto target = clang_getTranslationUnitTargetInfo(unit);
+    UnitTarget out{ClangString(clang_TargetInfo_getTriple(target)).str(), clang_TargetInfo_getPointerWidth(target)};
+    clang_TargetInfo_dispose(target);
+    return out;
+}
+
+// The widest atomic, in bytes, the target accesses with a single instruction instead of a lock. Matches the
+// MaxAtomicInlineWidth clang picks for the common targets, and the pointer width elsewhere.
+static int64_t atomicInlineWidth(const UnitTarget& target) {
+    auto& triple = target.triple;
+    if (triple.rfind("aarch64", 0) == 0 || triple.rfind("arm64", 0) == 0) return 16;
+    for (auto arch : {"x86_64", "i586", "i686", "armv7", "armv8"}) {
+        if (triple.rfind(arch, 0) == 0) return 8;
+    }
+    return std::max<int64_t>(0, target.pointerWidth) / 8;
+}
+
+// Spelling of each builtin kind that is emitted as a Primitive, or null.
+static constexpr const char* primitiveName(int kind) {
+    switch (kind) {
+        case CXType_Void: return "void";
+        case CXType_Bool: return "bool";
+
+        case CXType_Char_U: return "unsigned char";
+        case CXType_UChar: return "unsigned char";
+        case CXType_UShort: return "unsigned short";
+        case CXType_UInt: return "unsigned int";
+        case CXType_ULong: return "unsigned long";
+        case CXType_ULongLong: return "unsigned long long";
+        case CXType_UInt128: return "unsigned __int128";
+
+        case CXType_Char_S: return "signed char";
+        case CXType_SChar: return "signed char";
+        case CXType_Short: return "signed short";
+        case CXType_Int: return "signed int";
+        case CXType_Long: return "signed long";
+        case CXType_LongLong: return "signed long long";
+        case CXType_Int128: return "__int128";
+
+        case CXType_Char16: return "char16_t";
+        case CXType_Char32: return "char32_t";
+        case CXType_WChar: return "wchar_t";
+
+        case CXType_Half: return "half";
+        case CXType_Float16: return "_Float16";
+        case CXType_Float: return "float";
+        case CXType_Double: return "double";
+        case CXType_LongDouble: return "long double";
+        case CXType_Float128: return "__float128";
+
+        case CXType_NullPtr: return "nullptr_t";
+        default: return nullptr;
+    }
+}
+
+struct VisitContext;
+
+// What dumping a type needs besides the type itself.
+struct DumpContext {
+    // Intern types into this table and reference them by ID instead of expanding them inline.
+    TypeTable* types = nullptr;
+
+    // Reference typedefs by name and record their underlying types in this visit's typedefs section, instead of
+    // expanding them.
+    VisitContext* typedefs = nullptr;
+
+    // The widest atomic, in bytes, the target accesses without a lock.
+    int64_t atomicInlineWidth = 0;
+};
+
+json dumpType(CXType type, DumpContext& dump);
+json dumpTypeNode(CXType type, DumpContext& dump);
+
+static json dumpUnknownType(CXType type) {
+    return {{"kind", "Unknown"}, {"id", (unsigned  int)type.kind}, {"name", ClangString(clang_getTypeKindSpelling(type.kind)).view()}};
+}
+
+static json dumpFunctionType(CXType type, DumpContext& dump) {
+    json args = json::array();
+    int nArgs = clang_getNumArgTypes(type);
+    for (int i = 0; i < nArgs; i++) {
+        args.push_back(dumpType(clang_getArgType(type, i), dump));
+    }
+
+    json out;
+    out["kind"] = "Function";
+    out["argTypes"] = args;
+    out["returnType"] = dumpType(clang_getResultType(type), dump);
+
+    if (clang_isFunctionTypeVariadic(type)) {
+        out["varadic"] = true;
+    }
+
+    return out;
+}
+
+// Kinds newer libclang versions report for ext_vector_type vectors and _Atomic types, which libclang 6 reports as
+// Unexposed. The handler table is indexed by value, so they are handled whichever headers the tree is built against.
+constexpr int extVectorTypeKind = 176;
+constexpr int atomicTypeKind = 177;
+
+// Vectors keep their alignment, which is usually their whole size rather than their element's.
+static json dumpVectorType(CXType type, json elementType, long long lanes, bool ext) {
+    json out;
+    out["kind"] = "Vector";
+    if (!elementType.is_null()) out["elementType"] = std::move(elementType);
+    out["lanes"] = lanes;
+    out["align"] = clang_Type_getAlignOf(type);
+    if (ext) out["ext"] = true;
+    return out;
+}
+
+static json dumpAtomicType(CXType type, json valueType, DumpContext& dump) {
+    auto size = clang_Type_getSizeOf(type);
+    auto align = clang_Type_getAlignOf(type);
+    json out;
+    out["kind"] = "Atomic";
+    if (!valueType.is_null()) out["valueType"] = std::move(valueType);
+    out["size"] = size;
+    out["align"] = align;
+    out["lockFree"] = size > 0 && (size & (size - 1)) == 0 && size <= dump.atomicInlineWidth && align >= size;
+    return out;
+}
+
+// The Primitive node for a builtin type's spelling, or null when it is not one. Plain char is left out, since its
+// signedness depends on the target.
+static json spelledPrimitive(const std::string& spelling) {
+    static const std::unordered_map<std::string, int> kinds = {
+        {"_Bool", CXType_Bool}, {"bool", CXType_Bool},
+        {"signed char", CXType_SChar}, {"unsigned char", CXType_UChar},
+        {"short", CXType_Short}, {"unsigned short", CXType_UShort},
+        {"int", CXType_Int}, {"unsigned int", CXType_UInt},
+        {"long", CXType_Long}, {"unsigned long", CXType_ULong},
+        {"long long", CXType_LongLong}, {"unsigned long long", CXType_ULongLong},
+        {"__int128", CXType_Int128}, {"unsigned __int128", CXType_UInt128},
+        {"__fp16", CXType_Half}, {"_Float16", CXType_Float16},
+        {"float", CXType_Float}, {"double", CXType_Double}, {"long double", CXType_LongDouble},
+    };
+
+    auto it = kinds.find(spelling);
+    if (it == kinds.end()) return json();
+    return {{"kind", "Primitive"}, {"name", primitiveName(it->second)}};
+}
+
+// libclang 6 reports ext_vector_type vectors and _Atomic types as Unexposed, and offers no way to reach their element
+// or value type but their spelling. Only builtin element and value types are recovered.
+static json dumpUnexposedType(CXType type, DumpContext& dump) {
+    auto spelling = ClangString(clang_getTypeSpelling(type)).str();
+    if (spelling.rfind("_Atomic(", 0) == 0 && spelling.back() == ')') {
+        auto valueType = spelledPrimitive(spelling.substr(8, spelling.size() - 9));
+        if (!valueType.is_null() && dump.types) valueType = dump.types->intern(std::move(valueType));
+        return dumpAtomicType(type, std::move(valueType), dump);
+    }
+
+    constexpr std::string_view extVector = " __attribute__((ext_vector_type(";
+    auto ext = spelling.find(extVector);
+    if (ext != std::string::npos) {
+        auto elementType = spelledPrimitive(spelling.substr(0, ext));
+        if (!elementType.is_null() && dump.types) elementType = dump.types->intern(std::move(elementType));
+        auto lanes = strtoll(spelling.c_str() + ext + extVector.size(), nullptr, 10);
+        return dumpVectorType(type, std::move(elementType), lanes, true);
+    }
+
+    return dumpUnknownType(type);
+}
+
+static const char* callingConvName(CXCallingConv callingConv) {
+    switch (callingConv) {
+        case CXCallingConv_Default: return "Default";
+        case CXCallingConv_C: return "C";
+        case CXCallingConv_X86StdCall: return "X86StdCall";
+        case CXCallingConv_X86FastCall: return "X86FastCall";
+        case CXCallingConv_X86ThisCall: return "X86ThisCall";
+        case CXCallingConv_X86Pascal: return "X86Pascal";
+        case CXCallingConv_AAPCS: return "AAPCS";
+        case CXCallingConv_AAPCS_VFP: return "AAPCS_VFP";
+        case CXCallingConv_X86RegCall: return "X86RegCall";
+        case CXCallingConv_IntelOclBicc: return "IntelOclBicc";
+        case CXCallingConv_Win64: return "Win64";
+        case CXCallingConv_X86_64SysV: return "X86_64SysV";
+        case CXCallingConv_X86VectorCall: return "X86VectorCall";
+        case CXCallingConv_Swift: return "Swift";
+        case CXCallingConv_PreserveMost: return "PreserveMost";
+        case CXCallingConv_PreserveAll: return "PreserveAll";
+        case CXCallingConv_Invalid: return "Invalid";
+        default: return "Unexposed";
+    }
+}
+
+// How to dump a type node of each CXTypeKind. Kinds without a specialization are primitives or Unknown.
+template<int Kind>
+struct TypeKindHandler {
+    static json dumpNode(CXType type, DumpContext&) {
+        if constexpr (primitiveName(Kind) != nullptr) {
+            return {
+                {"kind", "Primitive"},
+                {"name", primitiveName(Kind)}
+            };
+        } else {
+            return dumpUnknownType(type);
+        }
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Pointer> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "Pointer"},
+            {"pointee", dumpType(clang_getPointeeType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_BlockPointer> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "BlockPointer"},
+            {"pointee", dumpType(clang_getPointeeType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_LValueReference> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "Reference"},
+            {"pointee", dumpType(clang_getPointeeType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_RValueReference> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "RValueReference"},
+            {"pointee", dumpType(clang_getPointeeType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_FunctionProto> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return dumpFunctionType(type, dump);
+    }
+};
+
+// A K&R declaration like int f(), which takes whatever it is passed.
+template<>
+struct TypeKindHandler<CXType_FunctionNoProto> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        auto out = dumpFunctionType(type, dump);
+        out["noPrototype"] = true;
+        return out;
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Record> {
+    static json dumpNode(CXType type, DumpContext&) {
+        CXCursor cursor = clang_getTypeDeclaration(type);
+        CXType tpe = clang_getCursorType(cursor);
+        return {
+            {"kind", "Struct"},
+            {"name", getTypeSpelling(tpe)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Enum> {
+    static json dumpNode(CXType type, DumpContext&) {
+        // The size follows the underlying type and a packed attribute, so consumers need not assume int.
+        return {
+            {"kind", "Enum"},
+            {"name", getTypeSpelling(type)},
+            {"size", clang_Type_getSizeOf(type)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_ConstantArray> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "Array"},
+            {"elementType", dumpType(clang_getArrayElementType(type), dump)},
+            {"size", clang_getArraySize(type)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_IncompleteArray> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "IncompleteArray"},
+            {"elementType", dumpType(clang_getArrayElementType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_VariableArray> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "VariableArray"},
+            {"elementType", dumpType(clang_getArrayElementType(type), dump)},
+        };
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Vector> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return dumpVectorType(type, dumpType(clang_getElementType(type), dump), clang_getNumElements(type), false);
+    }
+};
+
+template<>
+struct TypeKindHandler<extVectorTypeKind> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return dumpVectorType(type, dumpType(clang_getElementType(type), dump), clang_getNumElements(type), true);
+    }
+};
+
+template<>
+struct TypeKindHandler<atomicTypeKind> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+#if CINDEX_VERSION_MINOR >= 61
+        return dumpAtomicType(type, dumpType(clang_Type_getValueType(type), dump), dump);
+#else
+        return dumpAtomicType(type, json(), dump);
+#endif
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Complex> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return {
+            {"kind", "Complex"},
+            {"elementType", dumpType(clang_getElementType(type), dump)},
+        };
+    }
+};
+
+json dumpTypedefRef(CXType type, DumpContext& dump);
+
+// Sugar kinds only show up in types that were not canonicalized. Typedefs are referenced by name when asked to, and
+// everything else dumps as the type it stands for.
+template<>
+struct TypeKindHandler<CXType_Typedef> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        if (dump.typedefs) return dumpTypedefRef(type, dump);
+        return dumpTypeNode(clang_getCanonicalType(type), dump);
+    }
+};
+
+template<>
+struct TypeKindHandler<CXType_Elaborated> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        return dumpTypeNode(clang_Type_getNamedType(type), dump);
+    }
+};
+
+// Also covers sugar libclang does not expose, like parenthesized and attributed types.
+template<>
+struct TypeKindHandler<CXType_Unexposed> {
+    static json dumpNode(CXType type, DumpContext& dump) {
+        auto canonical = clang_getCanonicalType(type);
+        if (canonical.kind == CXType_Unexposed) return dumpUnexposedType(canonical, dump);
+        return dumpTypeNode(canonical, dump);
+    }
+};
+
+using TypeDumper = json (*)(CXType type, DumpContext& dump);
+
+template<size_t... Kinds>
+static constexpr std::array<TypeDumper, sizeof...(Kinds)> makeTypeDumpers(std::index_sequence<Kinds...>) {
+    return {{&TypeKindHandler<Kinds>::dumpNode...}};
+}
+
+// Every CXTypeKind value to its handler, so dispatching a type node is one indexed call.
+static constexpr auto typeDumpers = makeTypeDumpers(std::make_index_sequence<256>{});
+
+json dumpTypeNode(CXType type, DumpContext& dump) {
+    DumpTypeCounter counter;
+    PhaseTimer timer(Phase::DumpType);
+
+    auto kind = static_cast<unsigned>(type.kind);
+    return kind < typeDumpers.size() ? typeDumpers[kind](type, dump) : dumpUnknownType(type);
+}
+
+json dumpType(CXType type, DumpContext& dump) {
+    auto types = dump.types;
+    if (types == nullptr) {
+        return dumpTypeNode(type, dump);
+    }
+
+    // Canonical types with the same kind and spelling are the same type, so they are only expanded the first time.
+    TypeTable::SpellingKey spelling{type.kind, ClangString(clang_getTypeSpelling(type)).str()};
+    auto it = types->spellings.find(spelling);
+    if (it != types->spellings.end()) {
+        return it->second;
+    }
+
+    auto id = types->intern(dumpTypeNode(type, dump));
+    types->spellings.emplace(std::move(spelling), id);
+    return id;
+}
+
+// USRs already claimed by a worker. A declaration from a header shared by many translation units is extracted by
+// whichever worker reaches it first and skipped by every other one.
+class UsrClaims {
+public:
+    bool claim(const std::string& usr) {
+        auto& shard = _shards[std::hash<std::string>()(usr) % shardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.usrs.insert(usr).second;
+    }
+
+private:
+    static constexpr size_t shardCount = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_set<std::string> usrs;
+    };
+
+    Shard _shards[shardCount];
+};
+
+// Entities of one translation unit keyed by USR. Each entity's definition is looked up once however often it is
+// redeclared, redeclarations of an entity already emitted are skipped, and two different entities emitted under the
+// same name are reported instead of the later one overwriting the first. Claims shared with other translation units
+// extend the deduplication across a whole compilation database.
+class SymbolTable {
+public:
+    explicit SymbolTable(UsrClaims* claims) : _claims(claims) {}
+
+    bool isForwardDecl(CXCursor cursor) {
+        auto& usr = usrOf(cursor);
+        if (usr.empty()) return isForwardDecl(cursor, clang_getCursorDefinition(cursor));
+
+        auto& symbol = _symbols[usr];
+        if (!symbol.definitionKnown) {
+            symbol.definition = clang_getCursorDefinition(cursor);
+            symbol.definitionKnown = true;
+        }
+        return isForwardDecl(cursor, symbol.definition);
+    }
+
+    // Whether the entity still needs to be emitted. Claims it, so later redeclarations are skipped.
+    bool claim(CXCursor cursor) {
+        auto& usr = usrOf(cursor);
+        if (usr.empty()) return true;
+
+        auto& symbol = _symbols[usr];
+        if (symbol.claimed) return false;
+        symbol.claimed = true;
+        return !_claims || _claims->claim(usr);
+    }
+
+    // Whether the entity may be emitted as section[name], which is false when another entity already was.
+    bool claimName(const char* section, const std::string& name, CXCursor cursor) {
+        auto& usr = usrOf(cursor);
+        auto& owners = _owners[section];
+        auto it = owners.find(name);
+        if (it == owners.end()) it = owners.emplace(name, usr).first;
+        auto& owner = it->second;
+        if (owner == usr) return true;
+
+        warnings += "warning: '" + name + "' names both " + owner + " and " + usr;
+        warnings += "; keeping the first\n";
+        return false;
+    }
+
+    std::string warnings;
+
+private:
+    struct Symbol {
+        CXCursor definition;
+        bool definitionKnown = false;
+        bool claimed = false;
+    };
+
+    static bool isForwardDecl(CXCursor cursor, CXCursor definition) {
+        if (clang_equalCursors(definition, clang_getNullCursor())) return true;
+        return !clang_equalCursors(cursor, definition);
+    }
+
+    // Visitors ask about the same cursor several times in a row, so the last USR is remembered.
+    const std::string& usrOf(CXCursor cursor) {
+        if (!clang_equalCursors(cursor, _lastCursor)) {
+            _lastCursor = cursor;
+            _lastUsr.assign(ClangString(clang_getCursorUSR(cursor)).view());
+        }
+        return _lastUsr;
+    }
+
+    UsrClaims* _claims;
+    std::unordered_map<std::string, Symbol> _symbols;
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> _owners;
+    CXCursor _lastCursor = clang_getNullCursor();
+    std::string _lastUsr;
+};
+
+// An object-like macro found while visiting. Macros only become constants once the whole unit was visited, so that
+// the ones the literal fast path cannot handle are evaluated together.
+struct PendingMacro {
+    std::string name;
+    CXCursor cursor;
+};
+
+struct VisitContext {
+    json& info;
+
+    // Skip system headers, function bodies and records that were already visited instead of recursing everywhere.
+    bool prune = false;
+
+    // Interns types into a table and references typedefs by name when asked to.
+    DumpContext dump;
+
+    // Hand every top-level declaration to this writer as soon as it is visited instead of keeping it in info.
+    StreamWriter* stream = nullptr;
+
+    // Deduplicates entities by USR, within the translation unit and against the ones other units claimed.
+    SymbolTable* symbols = nullptr;
+
+    // Only top-level declarations located in one of these files are visited.
+    const std::unordered_set<std::string>* files = nullptr;
+
+    // Intern the files srcRefs point into here.
+    FileTable* fileTable = nullptr;
+    std::unordered_map<CXFile, size_t> fileIds;
+
+    // Each CXFile's name is only asked of libclang once per visit.
+    std::unordered_map<CXFile, std::string> fileNames;
+
+    // Record each function's calling convention, for classifying how it is called.
+    bool callingConvs = false;
+
+    // When set, functions the library does not export are skipped.
+    const ElfExports* exports = nullptr;
+
+    UnitTarget target;
+
+    // Macros to turn into constants after the visit, in definition order, and where each name is in it. A redefinition
+    // replaces the earlier definition.
+    std::vector<PendingMacro> macros;
+    std::unordered_map<std::string, size_t> macroIds;
+
+    std::string_view fileName(CXFile file) {
+        auto it = fileNames.find(file);
+        if (it == fileNames.end()) {
+            it = fileNames.emplace(file, ClangString(clang_getFileName(file)).str()).first;
+        }
+        return it->second;
+    }
+
+    bool inFiles(CXCursor cursor) const {
+        CXFile file;
+        clang_getFileLocation(clang_getCursorLocation(cursor), &file, nullptr, nullptr, nullptr);
+        return files->count(ClangString(clang_getFileName(file)).str()) != 0;
+    }
+
+
+    // The type to dump for a declaration of the given type: canonical, unless typedefs are referenced by name.
+    CXType dumpedType(CXType type) const {
+        return dump.typedefs ? type : clang_getCanonicalType(type);
+    }
+
+    bool has(const char* section, const std::string& name) const {
+        if (stream && stream->contains(section, name)) return true;
+        auto it = info.find(section);
+        return it != info.end() && it->count(name) != 0;
+    }
+};
+
+json dumpTypedefRef(CXType type, DumpContext& dump) {
+    auto& context = *dump.typedefs;
+    auto declaration = clang_getTypeDeclaration(type);
+    auto name = getCursorSpelling(declaration);
+
+    // Each typedef's underlying type is dumped once, and may itself reference other typedefs.
+    if (!context.has("typedefs", name)) {
+        auto underlying = dumpType(clang_getTypedefDeclUnderlyingType(declaration), dump);
+        context.info["typedefs"][name] = std::move(underlying);
+    }
+
+    return {
+        {"kind", "Typedef"},
+        {"name", name},
+    };
+}
+
+struct FieldVisitContext {
+    VisitContext& context;
+    json& fields;
+    // The record's name in structs, which its anonymous members' records are named after.
+    const std::string& name;
+
+    // Whether the record is laid out below its fields' natural alignment, by a packed attribute or #pragma pack, and
+    // whether an aligned attribute or alignas sets its alignment.
+    bool packed = false;
+    bool aligned = false;
+
+    // The largest natural alignment among the fields.
+    int64_t fieldAlign = 0;
+
+    size_t anonymousMembers = 0;
+};
+
+// CXCursor_AlignedAttr, which libclang 9 added, compared by value like atomicTypeKind. libclang 6 has no cursor
+// for aligned attributes, so fields are only marked aligned by newer versions, while records also infer it from their
+// alignment.
+constexpr int alignedAttrKind = 441;
+
+// The layout attributes written on a field.
+struct LayoutAttrs {
+    bool packed = false;
+    bool aligned = false;
+};
+
+static CXChildVisitResult attrVisitor(CXCursor cursor, CXCursor, CXClientData client_data) {
+    auto& attrs = *reinterpret_cast<LayoutAttrs*>(client_data);
+    auto kind = clang_getCursorKind(cursor);
+    if (kind == CXCursor_PackedAttr) attrs.packed = true;
+    if (kind == alignedAttrKind) attrs.aligned = true;
+    return CXChildVisit_Continue;
+}
+
+CXChildVisitResult typeVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
+static void addRecord(VisitContext& context, const std::string& name, CXCursor cursor);
+
+// Whether the cursor declares an anonymous struct or union member. clang_Cursor_isAnonymous tells exactly that up to
+// libclang 8, but any unnamed record from libclang 9 on, which added clang_Cursor_isAnonymousRecordDecl instead.
+static bool isAnonymousMember(CXCursor cursor) {
+    auto kind = clang_getCursorKind(cursor);
+    if (kind != CXCursor_StructDecl && kind != CXCursor_UnionDecl) return false;
+#if CINDEX_VERSION_MINOR >= 59
+    return clang_Cursor_isAnonymousRecordDecl(cursor);
+#else
+    return clang_Cursor_isAnonymous(cursor);
+#endif
+}
+
+// The name of the first named field of an anonymous record, looking through the anonymous records nested in it.
+static CXChildVisitResult firstFieldVisitor(CXCursor cursor, CXCursor, CXClientData client_data) {
+    auto& name = *reinterpret_cast<std::string*>(client_data);
+    if (clang_getCursorKind(cursor) == CXCursor_FieldDecl) {
+        name = ClangString(clang_getCursorSpelling(cursor)).str();
+    } else if (isAnonymousMember(cursor)) {
+        clang_visitChildren(cursor, firstFieldVisitor, client_data);
+    }
+    return name.empty() ? CXChildVisit_Continue : CXChildVisit_Break;
+}
+
+// An anonymous struct or union member is an implicit field, which libclang does not visit. It is emitted as an unnamed
+// field placed by way of its first named field, and its record goes to structs under a name made of the enclosing
+// record's and its position among the anonymous members, like "struct S::(anonymous union 0)". Unions are referenced
+// as kind Union, which the ABI classification leaves alone.
+static void addAnonymousMember(FieldVisitContext& fieldContext, CXCursor cursor, CXCursor parent) {
+    std::string first;
+    clang_visitChildren(cursor, firstFieldVisitor, reinterpret_cast<CXClientData>(&first));
+    if (first.empty()) return;
+    auto type = clang_getCursorType(cursor);
+    auto outer = clang_Type_getOffsetOf(clang_getCursorType(parent), first.c_str());
+    auto inner = clang_Type_getOffsetOf(type, first.c_str());
+    if (outer < 0 || inner < 0) return;
+
+    bool isUnion = clang_getCursorKind(cursor) == CXCursor_UnionDecl;
+    auto name = fieldContext.name + "::(anonymous " + (isUnion ? "union " : "struct ") +
+        std::to_string(fieldContext.anonymousMembers++) + ")";
+    addRecord(fieldContext.context, name, cursor);
+
+    json tpe = {
+        {"kind", isUnion ? "Union" : "Struct"},
+        {"name", name},
+    };
+    if (auto types = fieldContext.context.dump.types) tpe = types->intern(std::move(tpe));
+
+    auto size = clang_Type_getSizeOf(type);
+    auto align = clang_Type_getAlignOf(type);
+    auto bitOffset = outer - inner;
+    fieldContext.fieldAlign = std::max<int64_t>(fieldContext.fieldAlign, align);
+    if (align > 0 && bitOffset % (align * 8) != 0) fieldContext.packed = true;
+    fieldContext.fields.push_back({
+        {"size", size},
+        {"align", align},
+        {"offset", bitOffset / 8},
+        {"name", ""},
+        {"type", std::move(tpe)},
+    });
+}
+
+CXChildVisitResult fieldVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data) {
+    auto& fieldContext = *reinterpret_cast<FieldVisitContext*>(client_data);
+    auto cursorKind = clang_getCursorKind(cursor);
+    if (auto stats = Stats::current()) stats->countCursor(cursorKind);
+
+    if (cursorKind == CXCursor_PackedAttr) {
+        fieldContext.packed = true;
+    } else if (cursorKind == alignedAttrKind) {
+        fieldContext.aligned = true;
+    } else if (cursorKind == CXCursor_FieldDecl) {
+        PhaseTimer timer(Phase::Fields);
+        auto type = clang_getCursorType(cursor);
+        auto size = clang_Type_getSizeOf(type);
+        auto align = clang_Type_getAlignOf(type);
+        auto bitOffset = clang_Cursor_getOffsetOfField(cursor);
+        auto name = getCursorSpelling(cursor);
+        auto tpe = dumpType(fieldContext.context.dumpedType(type), fieldContext.context.dump);
+        fieldContext.fieldAlign = std::max<int64_t>(fieldContext.fieldAlign, align);
+        json field = {
+            {"size", size},
+            {"align", align},
+            {"offset", getOffsetOfFieldInBytes(cursor)},
+            {"name", name},
+            {"type", tpe},
+        };
+
+        // Every other field starts on a byte, at offset * 8 bits, and spans the whole of size.
+        if (clang_Cursor_isBitField(cursor)) {
+            field["bitOffset"] = bitOffset;
+            field["bitWidth"] = clang_getFieldDeclBitWidth(cursor);
+        } else if (bitOffset >= 0 && align > 0 && bitOffset % (align * 8) != 0) {
+            fieldContext.packed = true;
+        }
+
+        if (clang_Cursor_hasAttrs(cursor)) {
+            LayoutAttrs attrs;
+            clang_visitChildren(cursor, attrVisitor, reinterpret_cast<CXClientData>(&attrs));
+            if (attrs.packed) field["packed"] = true;
+            if (attrs.aligned) field["aligned"] = true;
+        }
+        fieldContext.fields.push_back(std::move(field));
+    } else {
+        if (isAnonymousMember(cursor)) {
+            addAnonymousMember(fieldContext, cursor, parent);
+        }
+        if (fieldContext.context.prune) {
+            // typeVisitor does not recurse into records it handled when pruning, so nested declarations are picked up
+            // here.
+            auto context = reinterpret_cast<CXClientData>(&fieldContext.context);
+            if (typeVisitor(cursor, parent, context) == CXChildVisit_Recurse) {
+                clang_visitChildren(cursor, typeVisitor, context);
+            }
+        }
+    }
+
+    return CXChildVisit_Continue;
+}
+
+static void addSrcRef(VisitContext& context, const std::string& name, CXCursor cursor) {
+    CXFile file;
+    unsigned int line;
+    unsigned int col;
+    unsigned int offset;
+    clang_getFileLocation(clang_getCursorLocation(cursor), &file, &line, &col, &offset);
+
+    auto& srcRef = context.info["srcRefs"][name];
+    if (context.fileTable) {
+        auto it = context.fileIds.find(file);
+        if (it == context.fileIds.end()) {
+            auto id = context.fileTable->intern(std::string(context.fileName(file)));
+            it = context.fileIds.emplace(file, id).first;
+        }
+        srcRef = json::array({it->second, line, col, offset});
+        return;
+    }
+
+    srcRef["fileName"] = context.fileName(file);
+    srcRef["line"] = line;
+    srcRef["col"] = col;
+    srcRef["offset"] = offset;
+}
+
+// The value of a variable's initializer, when it evaluates to an integer, floating point or string constant.
+static bool evaluateCursor(CXCursor cursor, json& value) {
+    PhaseTimer timer(Phase::Evaluate);
+    auto eval = clang_Cursor_Evaluate(cursor);
+    bool success = true;
+    switch (clang_EvalResult_getKind(eval)) {
+        case CXEval_Int:
+            if (clang_EvalResult_isUnsignedInt(eval)) {
+                value = clang_EvalResult_getAsUnsigned(eval);
+            } else {
+                value = clang_EvalResult_getAsLongLong(eval);
+            }
+            break;
+        case CXEval_Float:
+            value = clang_EvalResult_getAsDouble(eval);
+            break;
+        case CXEval_StrLiteral:
+            value = clang_EvalResult_getAsStr(eval);
+            break;
+        default:
+            success = false;
+    }
+    clang_EvalResult_dispose(eval);
+    return success;
+}
+
+// A type node built without a CXType, interned like dumpType would when there is a type table.
+static json internNode(json node, DumpContext& dump) {
+    if (dump.types) return dump.types->intern(std::move(node));
+    return node;
+}
+
+static json primitiveType(int kind, DumpContext& dump) {
+    return internNode({{"kind", "Primitive"}, {"name", primitiveName(kind)}}, dump);
+}
+
+// The type and value of an integer literal, following the C rules for picking its type. Literals whose type depends
+// on the target's long width, and negated unsigned literals, are left to the evaluation unit.
+static bool integerLiteral(const std::string& text, bool negative, int& kind, json& value) {
+    auto suffixStart = text.find_first_of("uUlL");
+    auto digits = text.substr(0, suffixStart);
+    std::string suffix;
+    if (suffixStart != std::string::npos) {
+        for (auto c : text.substr(suffixStart)) suffix += (char)tolower(c);
+    }
+
+    bool isUnsigned = suffix.find('u') != std::string::npos;
+    auto longs = std::count(suffix.begin(), suffix.end(), 'l');
+    if (suffix.size() != (size_t)longs + isUnsigned || longs > 2 || (longs == 2 && suffix.find("ll") == std::string::npos)) {
+        return false;
+    }
+
+    errno = 0;
+    char* end;
+    auto magnitude = strtoull(digits.c_str(), &end, 0);
+    if (digits.empty() || *end != '\0' || errno != 0) return false;
+    bool decimal = digits.size() == 1 || digits[0] != '0';
+
+    if (!isUnsigned && longs == 0 && magnitude <= INT_MAX) {
+        kind = CXType_Int;
+    } else if (!isUnsigned && longs == 1 && magnitude <= INT32_MAX) {
+        kind = CXType_Long;
+    } else if (!isUnsigned && longs == 2 && magnitude <= LLONG_MAX) {
+        kind = CXType_LongLong;
+    } else if ((isUnsigned || !decimal) && longs == 0 && magnitude <= UINT_MAX) {
+        kind = CXType_UInt;
+    } else if (isUnsigned && longs == 1 && magnitude <= UINT32_MAX) {
+        kind = CXType_ULong;
+    } else if ((isUnsigned || !decimal) && longs == 2) {
+        kind = CXType_ULongLong;
+    } else {
+        return false;
+    }
+
+    bool isSigned = kind == CXType_Int || kind == CXType_Long || kind == CXType_LongLong;
+    if (isSigned) {
+        value = negative ? -(long long)magnitude : (long long)magnitude;
+    } else if (negative) {
+        return false;
+    } else {
+        value = (unsigned long long)magnitude;
+    }
+    return true;
+}
+
+static bool floatLiteral(const std::string& text, bool negative, int& kind, json& value) {
+    auto digits = text;
+    kind = CXType_Double;
+    switch (digits.back()) {
+        case 'f': case 'F': kind = CXType_Float; digits.pop_back(); break;
+        case 'l': case 'L': kind = CXType_LongDouble; digits.pop_back(); break;
+    }
+
+    char* end;
+    auto magnitude = strtod(digits.c_str(), &end);
+    if (digits.empty() || *end != '\0') return false;
+    value = negative ? -magnitude : magnitude;
+    return true;
+}
+
+// Appends the contents of a plain string literal token. Escapes besides the simple ones are left to the evaluation
+// unit.
+static bool appendStringLiteral(const std::string& text, std::string& out) {
+    if (text.size() < 2 || text.front() != '"' || text.back() != '"') return false;
+    for (size_t i = 1; i + 1 < text.size(); i++) {
+        char c = text[i];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+
+        c = text[++i];
+        switch (c) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'v': out += '\v'; break;
+            case '\\': case '"': case '\'': case '?': out += c; break;
+            case '0':
+                if (isdigit((unsigned char)text[i + 1])) return false;
+                out += '\0';
+                break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+// Whether plain char is unsigned for the target, unless the args say otherwise.
+static bool isCharUnsigned(const UnitTarget& target, const std::vector<std::string>& args) {
+    for (auto it = args.rbegin(); it != args.rend(); ++it) {
+        if (*it == "-funsigned-char" || *it == "-fno-signed-char") return true;
+        if (*it == "-fsigned-char" || *it == "-fno-unsigned-char") return false;
+    }
+
+    auto& triple = target.triple;
+    if (triple.find("apple") != std::string::npos || triple.find("windows") != std::string::npos) return false;
+    for (auto arch : {"arm", "aarch64", "powerpc", "ppc", "s390", "riscv"}) {
+        if (triple.rfind(arch, 0) == 0) return true;
+    }
+    return false;
+}
+
+// The type and value of a macro whose body is a single integer, floating point or string literal, possibly negated
+// and parenthesized. body holds the spelling of each token after the macro's name.
+static bool literalMacro(
+    const std::vector<std::string>& body, const std::vector<CXTokenKind>& kinds, bool unsignedChar, DumpContext& dump,
+    json& type, json& value
+) {
+    size_t begin = 0;
+    size_t end = body.size();
+    while (end - begin >= 3 && body[begin] == "(" && body[end - 1] == ")") {
+        begin++;
+        end--;
+    }
+    bool negative = end - begin == 2 && body[begin] == "-";
+    if (negative) begin++;
+
+    for (auto i = begin; i < end; i++) {
+        if (kinds[i] != CXToken_Literal) return false;
+    }
+
+    auto& first = body[begin];
+    if (first[0] == '"') {
+        // Adjacent string literals are concatenated.
+        std::string contents;
+        for (auto i = begin; i < end; i++) {
+            if (!appendStringLiteral(body[i], contents)) return false;
+        }
+        if (negative) return false;
+        value = std::move(contents);
+        type = internNode({
+            {"kind", "Pointer"},
+            {"pointee", primitiveType(unsignedChar ? CXType_Char_U : CXType_Char_S, dump)},
+        }, dump);
+        return true;
+    }
+
+    if (end - begin != 1 || (!isdigit((unsigned char)first[0]) && first[0] != '.')) return false;
+
+    int kind;
+    bool hex = first.size() > 1 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X');
+    if (hex) {
+        // Hexadecimal floating point literals are rare enough to leave to the evaluation unit.
+        if (first.find_first_of(".pP") != std::string::npos || !integerLiteral(first, negative, kind, value)) {
+            return false;
+        }
+    } else if (first.find_first_of(".eE") != std::string::npos) {
+        if (!floatLiteral(first, negative, kind, value)) return false;
+    } else if (!integerLiteral(first, negative, kind, value)) {
+        return false;
+    }
+
+    type = primitiveType(kind, dump);
+    return true;
+}
+
+// Queues an object-like macro to become a constant once the visit is done, including the macros of the headers an
+// umbrella header or source file includes. Macros of system headers are left out: they alone define thousands, and
+// evaluating them would cost about as much as parsing the header again.
+static void collectMacro(VisitContext& context, CXCursor cursor) {
+    if (clang_Cursor_isMacroBuiltin(cursor) || clang_Cursor_isMacroFunctionLike(cursor)) return;
+
+    auto location = clang_getCursorLocation(cursor);
+    CXFile file;
+    clang_getFileLocation(location, &file, nullptr, nullptr, nullptr);
+    if (file == nullptr || clang_Location_isInSystemHeader(location)) return;
+
+    auto name = getCursorSpelling(cursor);
+    auto inserted = context.macroIds.emplace(name, context.macros.size());
+    if (inserted.second) {
+        context.macros.push_back({std::move(name), cursor});
+    } else {
+        context.macros[inserted.first->second].cursor = cursor;
+    }
+}
+
+// Emits a macro as a constant, unless its name is already taken, as by the enum constant in the common
+// "#define FOO FOO" idiom.
+static void addMacroConstant(VisitContext& context, const PendingMacro& macro, json type, json value) {
+    if (context.has("constants", macro.name) || !context.symbols->claim(macro.cursor) ||
+        !context.symbols->claimName("constants", macro.name, macro.cursor)) {
+        return;
+    }
+
+    auto& constant = context.info["constants"][macro.name];
+    constant["type"] = std::move(type);
+    constant["value"] = std::move(value);
+    addSrcRef(context, macro.name, macro.cursor);
+}
+
+// Emits the record's size, alignment, fields and layout attributes as structs[name].
+static void addRecord(VisitContext& context, const std::string& name, CXCursor cursor) {
+    auto& record = context.info["structs"][name];
+    auto type = clang_getCursorType(cursor);
+    auto size = clang_Type_getSizeOf(type);
+    auto align = clang_Type_getAlignOf(type);
+    record["size"] = size;
+    record["align"] = align;
+    if (clang_getCursorKind(cursor) == CXCursor_UnionDecl) record["union"] = true;
+    record["fields"] = json::array();
+    FieldVisitContext fieldContext{context, record["fields"], name};
+    clang_visitChildren(cursor, fieldVisitor, reinterpret_cast<CXClientData>(&fieldContext));
+
+    // The visit may have added the records of anonymous members to structs, so record is looked up again.
+    auto& entry = context.info["structs"][name];
+    // #pragma pack has no cursor, but shows as a field or the record itself aligned below its natural alignment.
+    if (fieldContext.packed || fieldContext.fieldAlign > align) entry["packed"] = true;
+    // Likewise an aligned attribute shows as the record aligned above its fields, when libclang does not report it.
+    if (fieldContext.aligned || align > std::max<int64_t>(1, fieldContext.fieldAlign)) entry["aligned"] = true;
+}
+
+CXChildVisitResult typeVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data) {
+    auto& context = *reinterpret_cast<VisitContext*>(client_data);
+    auto& info = context.info;
+    auto kind = clang_getCursorKind(cursor);
+    if (auto stats = Stats::current()) stats->countCursor(kind);
+
+    if (context.prune && clang_Location_isInSystemHeader(clang_getCursorLocation(cursor))) {
+        return CXChildVisit_Continue;
+    }
+
+    if (context.files && clang_getCursorKind(parent) == CXCursor_TranslationUnit && !context.inFiles(cursor)) {
+        return CXChildVisit_Continue;
+    }
+
+    if (kind == CXCursor_MacroDefinition) {
+        collectMacro(context, cursor);
+        return CXChildVisit_Continue;
+    }
+
+    if ((kind == CXCursor_ClassDecl || kind == CXCursor_StructDecl) && !isAnonymousType(cursor) && !context.symbols->isForwardDecl(cursor)) {
+        auto type = clang_getCursorType(cursor);
+        auto name = getTypeSpelling(type);
+        if ((context.prune && context.has("structs", name)) || !context.symbols->claim(cursor) ||
+            !context.symbols->claimName("structs", name, cursor)) {
+            return CXChildVisit_Continue;
+        }
+
+        addRecord(context, name, cursor);
+        addSrcRef(context, name, cursor);
+
+        if (context.prune) return CXChildVisit_Continue;
+    } else if (kind == CXCursor_FunctionDecl) {
+        // Static and inline-only functions have no symbol, and the rest are looked up by the name they link under.
+        std::string version;
+        if (context.exports) {
+            if (clang_getCursorLinkage(cursor) != CXLinkage_External) return CXChildVisit_Continue;
+            auto mangled = ClangString(clang_Cursor_getMangling(cursor));
+            auto symbol = mangled.view();
+            if (symbol.empty()) symbol = getCursorSpelling(cursor);
+            if (!context.exports->find(symbol, version)) return CXChildVisit_Continue;
+        }
+        if (!context.symbols->claim(cursor)) return CXChildVisit_Continue;
+
+        auto type = clang_getCursorType(cursor);
+        auto canType = clang_getCanonicalType(type);
+        auto name = getCursorSpelling(cursor);
+        if (!context.symbols->claimName("vars", name, cursor)) return CXChildVisit_Continue;
+        // A function declared through a typedef of its type still dumps as the function type itself.
+        auto fnType = context.dumpedType(type);
+        if (fnType.kind != CXType_FunctionProto && fnType.kind != CXType_FunctionNoProto) fnType = canType;
+        info["vars"][name] = dumpTypeNode(fnType, context.dump);
+        info["vars"][name].erase("kind");
+        if (context.callingConvs) {
+            info["vars"][name]["callingConv"] = callingConvName(clang_getFunctionTypeCallingConv(fnType));
+        }
+        if (!version.empty()) info["vars"][name]["version"] = version;
+        addSrcRef(context, name, cursor);
+
+        if (context.prune) return CXChildVisit_Continue;
+    } else if (kind == CXCursor_EnumDecl) {
+        // The constants of an enum another translation unit already claimed are claimed along with it.
+        if (!context.symbols->claim(cursor)) return CXChildVisit_Continue;
+    } else if (kind == CXCursor_EnumConstantDecl) {
+        auto name = getCursorSpelling(cursor);
+        if (!context.symbols->claimName("constants", name, cursor)) return CXChildVisit_Continue;
+        auto type = clang_getCanonicalType(clang_getCursorType(cursor));
+        info["constants"][name]["type"] = dumpType(type, context.dump);
+        info["constants"][name]["value"] = clang_getEnumConstantDeclValue(cursor);
+        addSrcRef(context, name, cursor);
+
+        if (context.prune) return CXChildVisit_Continue;
+    } else if (kind == CXCursor_VarDecl) {
+        // Only constants at file scope are evaluated; locals and mutable globals never have a value to emit. The const
+        // may come from a typedef, which only the canonical type carries.
+        auto type = clang_getCursorType(cursor);
+        auto scope = clang_getCursorKind(clang_getCursorSemanticParent(cursor));
+        bool constant = clang_isConstQualifiedType(clang_getCanonicalType(type));
+        if ((scope != CXCursor_TranslationUnit && scope != CXCursor_Namespace) || !constant) {
+            return context.prune ? CXChildVisit_Continue : CXChildVisit_Recurse;
+        }
+        // Only a declaration with a value claims the constant, so an extern declaration seen first, in this unit or in
+        // another, leaves it to the definition.
+        json outValue;
+        if (!evaluateCursor(cursor, outValue)) return context.prune ? CXChildVisit_Continue : CXChildVisit_Recurse;
+        if (!context.symbols->claim(cursor)) return CXChildVisit_Continue;
+
+        auto name = getCursorSpelling(cursor);
+        if (context.symbols->claimName("constants", name, cursor)) {
+            info["constants"][name]["type"] = dumpType(context.dumpedType(type), context.dump);
+            info["constants"][name]["value"] = outValue;
+            addSrcRef(context, name, cursor);
+        }
+
+        if (context.prune) return CXChildVisit_Continue;
+    } else if (context.prune && (kind == CXCursor_TypedefDecl || kind == CXCursor_ParmDecl)) {
+        // Record and enum definitions written inside a typedef are visited as siblings, so nothing below is needed.
+        return CXChildVisit_Continue;
+    }
+
+    return CXChildVisit_Recurse;
+}
+
+// Flushes what the last top-level visit produced to the stream writer, so info never holds more than one
+// declaration's entries.
+static void flushToStream(VisitContext& context) {
+    for (auto& section : context.info.items()) {
+        for (auto& entry : section.value().items()) {
+            context.stream->emit(section.key(), entry.key(), entry.value());
+        }
+    }
+    context.info = json();
+}
+
+CXChildVisitResult streamVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data) {
+    auto result = typeVisitor(cursor, parent, client_data);
+    flushToStream(*reinterpret_cast<VisitContext*>(client_data));
+    if (result == CXChildVisit_Recurse) {
+        clang_visitChildren(cursor, streamVisitor, client_data);
+    }
+    return CXChildVisit_Continue;
+}
+
+std::string outputConfig(const Options& options) {
+    auto config = ClangString(clang_getClangVersion()).str();
+    if (options.prune) config += " prune";
+    if (options.typeTable) config += " type-table";
+    if (options.fileTable) config += " file-table";
+    if (options.typedefRefs) config += " typedefs";
+    if (options.macros) config += " macros";
+    if (options.abi) config += " abi";
+    if (options.exports) config += " exports " + options.exports->identity();
+    return config;
+}
+
+static void inclusionVisitor(CXFile file, CXSourceLocation*, unsigned, CXClientData client_data) {
+    auto& deps = *reinterpret_cast<std::vector<std::string>*>(client_data);
+    deps.push_back(ClangString(clang_getFileName(file)).str());
+}
+
+// A translation unit to extract: a header or source file and the clang args to parse it with.
+struct Input {
+    std::string path;
+    std::vector<std::string> args;
+    // Whether args are the ones the PCH was built with, so it can be included.
+    bool pch = false;
+};
+
+struct ExtractConfig {
+    // Added to the args of inputs that can use the PCH, whose dependencies the cached results also depend on.
+    std::vector<std::string> pchArgs;
+    std::vector<std::string> pchDeps;
+    const ResultCache* cache = nullptr;
+    unsigned parseFlags = CXTranslationUnit_None;
+    bool prune = false;
+    bool typeTable = false;
+    bool fileTable = false;
+    bool typedefRefs = false;
+    bool callingConvs = false;
+    const ElfExports* exports = nullptr;
+    StreamWriter* stream = nullptr;
+    TypeTable* sharedTypes = nullptr;
+    FileTable* sharedFiles = nullptr;
+    bool stats = false;
+    UsrClaims* claims = nullptr;
+    const std::unordered_set<std::string>* files = nullptr;
+    std::vector<CXUnsavedFile> unsavedFiles;
+};
+
+// Prefix of the constants the macro evaluation unit declares, followed by the macro's index.
+constexpr std::string_view macroConstantPrefix = "__nativebindgen_macro_";
+
+struct MacroEvaluation {
+    VisitContext& context;
+    const std::vector<const PendingMacro*>& macros;
+};
+
+static CXChildVisitResult macroEvaluationVisitor(CXCursor cursor, CXCursor, CXClientData client_data) {
+    auto& evaluation = *reinterpret_cast<MacroEvaluation*>(client_data);
+    if (clang_getCursorKind(cursor) != CXCursor_VarDecl || !clang_Location_isFromMainFile(clang_getCursorLocation(cursor))) {
+        return CXChildVisit_Continue;
+    }
+
+    ClangString spelling(clang_getCursorSpelling(cursor));
+    auto name = spelling.view();
+    if (name.substr(0, macroConstantPrefix.size()) != macroConstantPrefix) return CXChildVisit_Continue;
+    auto index = strtoul(name.data() + macroConstantPrefix.size(), nullptr, 10);
+    if (index >= evaluation.macros.size()) return CXChildVisit_Continue;
+
+    json value;
+    if (evaluateCursor(cursor, value)) {
+        // The constant's declared type is deduced, so only its canonical type says what the macro expands to.
+        auto type = dumpType(clang_getCanonicalType(clang_getCursorType(cursor)), evaluation.context.dump);
+        addMacroConstant(evaluation.context, *evaluation.macros[index], std::move(type), std::move(value));
+    }
+    return CXChildVisit_Continue;
+}
+
+// Evaluates every macro the literal fast path could not handle with a single parse: a unit including the header
+// declares one constant initialized to each macro, and each constant's initializer is evaluated in turn. Macros that do
+// not expand to a constant expression only cost that declaration an error. args are the header's own, so when it was
+// parsed with -include-pch the evaluation unit reuses the PCH too and only parses what the prefix does not cover.
+static void evaluateMacros(
+    VisitContext& context, CXTranslationUnit unit, const std::vector<const PendingMacro*>& macros,
+    const std::vector<std::string>& args, const ExtractConfig& config
+) {
+    auto header = ClangString(clang_getTranslationUnitSpelling(unit)).str();
+    auto slash = header.rfind('/');
+    auto dot = header.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = header.size();
+
+    // The unit sits next to the header and keeps its extension, so it is parsed as the same language.
+    auto path = header.substr(0, dot) + ".nativebindgen-macros" + header.substr(dot);
+    std::string source = "#include \"" + header.substr(slash == std::string::npos ? 0 : slash + 1) + "\"\n"
+        "#ifdef __cplusplus\n"
+        "#define __nativebindgen_constant constexpr auto\n"
+        "#else\n"
+        "#define __nativebindgen_constant static const __auto_type\n"
+        "#endif\n";
+    for (size_t i = 0; i < macros.size(); i++) {
+        source += "__nativebindgen_constant ";
+        source += macroConstantPrefix;
+        source += std::to_string(i) + " = " + macros[i]->name + ";\n";
+    }
+
+    auto unsavedFiles = config.unsavedFiles;
+    unsavedFiles.push_back({path.c_str(), source.data(), (unsigned long)source.size()});
+
+    // Without a limit the parser gives up on the rest of the unit after the first few macros that fail to evaluate.
+    std::vector<const char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(arg.c_str());
+    }
+    argv.push_back("-ferror-limit=0");
+
+    auto index = clang_createIndex(0, 0);
+    CXTranslationUnit evaluationUnit = nullptr;
+    CXErrorCode err;
+    {
+        PhaseTimer timer(Phase::Parse);
+        // Bodies of constexpr functions are kept even when skipping function bodies.
+        err = clang_parseTranslationUnit2(
+            index,
+            path.c_str(), argv.data(), (int)argv.size(),
+            unsavedFiles.data(), (unsigned)unsavedFiles.size(),
+            (config.parseFlags & ~CXTranslationUnit_DetailedPreprocessingRecord) | CXTranslationUnit_SkipFunctionBodies,
+            &evaluationUnit
+        );
+    }
+
+    if (err == CXError_Success) {
+        MacroEvaluation evaluation{context, macros};
+        clang_visitChildren(
+            clang_getTranslationUnitCursor(evaluationUnit), macroEvaluationVisitor, reinterpret_cast<CXClientData>(&evaluation)
+        );
+        clang_disposeTranslationUnit(evaluationUnit);
+    }
+    clang_disposeIndex(index);
+}
+
+// Turns the macros collected while visiting into constants, reading literals straight from their tokens and
+// evaluating the rest in one batch.
+static void resolveMacros(
+    VisitContext& context, CXTranslationUnit unit, const std::vector<std::string>& args, const ExtractConfig& config
+) {
+    if (context.macros.empty()) return;
+
+    bool unsignedChar = isCharUnsigned(context.target, args);
+    std::vector<const PendingMacro*> remaining;
+    std::vector<std::string> body;
+    std::vector<CXTokenKind> kinds;
+    for (auto& macro : context.macros) {
+        CXToken* tokens;
+        unsigned count;
+        clang_tokenize(unit, clang_getCursorExtent(macro.cursor), &tokens, &count);
+
+        // The first token is the macro's name.
+        body.clear();
+        kinds.clear();
+        int depth = 0;
+        for (unsigned i = 1; i < count; i++) {
+            body.push_back(ClangString(clang_getTokenSpelling(unit, tokens[i])).str());
+            kinds.push_back(clang_getTokenKind(tokens[i]));
+            if (kinds.back() != CXToken_Punctuation) continue;
+
+            auto& token = body.back();
+            if (token == "(" || token == "[" || token == "{") depth++;
+            if (token == ")" || token == "]" || token == "}") depth--;
+            if (depth < 0) break;
+        }
+        clang_disposeTokens(unit, tokens, count);
+
+        // Unbalanced brackets would swallow the declarations after this one in the evaluation unit.
+        if (body.empty() || depth != 0) continue;
+
+        json type;
+        json value;
+        if (literalMacro(body, kinds, unsignedChar, context.dump, type, value)) {
+            addMacroConstant(context, macro, std::move(type), std::move(value));
+        } else {
+            remaining.push_back(&macro);
+        }
+    }
+
+    if (!remaining.empty()) {
+        evaluateMacros(context, unit, remaining, args, config);
+    }
+    context.macros.clear();
+    context.macroIds.clear();
+}
+
+// Collects the unit's diagnostics and visits its declarations into result. args are what the unit was parsed with.
+static void visitUnit(
+    CXTranslationUnit unit, const std::vector<std::string>& args, const ExtractConfig& config, HeaderResult& result
+) {
+    for (unsigned I = 0, N = clang_getNumDiagnostics(unit); I != N; ++I) {
+        CXDiagnostic diag = clang_getDiagnostic(unit, I);
+        result.diagnostics += ClangString(clang_formatDiagnostic(diag, clang_defaultDiagnosticDisplayOptions())).str();
+        result.diagnostics += "\n";
+        clang_disposeDiagnostic(diag);
+    }
+
+    CXCursor rootCursor = clang_getTranslationUnitCursor(unit);
+    TypeTable localTypes;
+    auto types = config.sharedTypes ? config.sharedTypes : &localTypes;
+    FileTable localFiles;
+    auto files = config.sharedFiles ? config.sharedFiles : &localFiles;
+    SymbolTable symbols(config.claims);
+    VisitContext context{
+        result.info, config.prune, {config.typeTable ? types : nullptr}, config.stream, &symbols, config.files,
+        config.fileTable ? files : nullptr
+    };
+    if (config.typedefRefs) {
+        context.dump.typedefs = &context;
+    }
+    context.callingConvs = config.callingConvs;
+    context.exports = config.exports;
+    context.target = unitTarget(unit);
+    context.dump.atomicInlineWidth = atomicInlineWidth(context.target);
+    result.info["targets"][context.target.triple] = {{"pointerWidth", context.target.pointerWidth}};
+    {
+        PhaseTimer timer(Phase::Visit);
+        clang_visitChildren(rootCursor, config.stream ? streamVisitor : typeVisitor, reinterpret_cast<CXClientData>(&context));
+    }
+    resolveMacros(context, unit, args, config);
+    if (config.stream) {
+        flushToStream(context);
+    }
+    result.diagnostics += symbols.warnings;
+    if (config.typeTable && !config.sharedTypes) {
+        result.info["types"] = std::move(localTypes.entries);
+    }
+    if (config.fileTable && !config.sharedFiles) {
+        result.info["files"] = std::move(localFiles.entries);
+    }
+
+    if (config.stats) {
+        result.stats.addResourceUsage(unit);
+    }
+}
+
+static ExtractConfig extractConfig(const Options& options) {
+    ExtractConfig config;
+    config.stats = options.stats;
+    config.prune = options.prune;
+    config.typeTable = options.typeTable;
+    config.fileTable = options.fileTable;
+    config.typedefRefs = options.typedefRefs;
+    config.callingConvs = options.abi;
+    config.exports = options.exports.get();
+    config.parseFlags = parseFlags(options);
+    return config;
+}
+
+unsigned parseFlags(const Options& options) {
+    unsigned flags = CXTranslationUnit_None;
+    if (options.prune) {
+        flags |= CXTranslationUnit_SkipFunctionBodies;
+    }
+    if (options.macros) {
+        flags |= CXTranslationUnit_DetailedPreprocessingRecord;
+    }
+    return flags;
+}
+
+HeaderResult extractUnit(
+    CXTranslationUnit unit, const Options& options, const std::vector<std::string>& args,
+    const std::unordered_set<std::string>* files
+) {
+    HeaderResult result;
+    auto config = extractConfig(options);
+    config.files = files;
+    StatsScope statsScope(config.stats ? &result.stats : nullptr);
+    result.stats.headers = 1;
+    visitUnit(unit, args, config, result);
+    result.ok = true;
+    return result;
+}
+
+CXTranslationUnit parseWarmUnit(
+    CXIndex index, const std::string& header, const std::vector<std::string>& args, const Options& options,
+    std::string& error
+) {
+    std::vector<const char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(arg.c_str());
+    }
+
+    // The preamble (the leading run of #includes) is precompiled on the first parse, so reparses after an edit to the
+    // header itself only redo its own body.
+    CXTranslationUnit unit = nullptr;
+    CXErrorCode err;
+    {
+        PhaseTimer timer(Phase::Parse);
+        err = clang_parseTranslationUnit2(
+            index,
+            header.c_str(), argv.data(), (int)argv.size(),
+            nullptr, 0,
+            parseFlags(options) | CXTranslationUnit_PrecompiledPreamble | CXTranslationUnit_CreatePreambleOnFirstParse,
+            &unit
+        );
+    }
+
+    if (err != CXError_Success) {
+        error = "Unable to parse translation unit " + header + ": " + std::to_string(err);
+        return nullptr;
+    }
+    return unit;
+}
+
+std::vector<std::string> unitInclusions(CXTranslationUnit unit) {
+    std::vector<std::string> files;
+    clang_getInclusions(unit, inclusionVisitor, reinterpret_cast<CXClientData>(&files));
+    return files;
+}
+
+HeaderResult extractHeader(CXIndex index, const Input& input, const ExtractConfig& config) {
+    HeaderResult result;
+    StatsScope statsScope(config.stats ? &result.stats : nullptr);
+    result.stats.headers = 1;
+
+    auto& header = input.path;
+    auto allArgs = input.args;
+    if (input.pch) allArgs.insert(allArgs.end(), config.pchArgs.begin(), config.pchArgs.end());
+
+    if (config.cache && config.cache->lookup(header, allArgs, result.info)) {
+        result.stats.cacheHits = 1;
+        result.ok = true;
+        return result;
+    }
+
+    std::vector<const char*> args;
+    for (auto& arg : allArgs) {
+        args.push_back(arg.c_str());
+    }
+
+    CXTranslationUnit unit;
+    CXErrorCode err;
+    {
+        PhaseTimer timer(Phase::Parse);
+        err = clang_parseTranslationUnit2(
+            index,
+            header.c_str(), args.data(), (int)args.size(),
+            const_cast<CXUnsavedFile*>(config.unsavedFiles.data()), (unsigned)config.unsavedFiles.size(),
+            config.parseFlags,
+            &unit
+        );
+    }
+
+    if (err != CXError_Success) {
+        if (unit == nullptr) {
+            result.diagnostics += "Unit null\n";
+        }
+
+        result.diagnostics += "Unable to parse translation unit " + header + ": " + std::to_string(err) + "\n";
+        return result;
+    }
+
+    visitUnit(unit, allArgs, config, result);
+
+    // Results with diagnostics are not cached, so the next run reports them again. Neither are results missing the
+    // declarations other translation units claimed.
+    if (config.cache && !config.claims && result.diagnostics.empty()) {
+        auto deps = input.pch ? config.pchDeps : std::vector<std::string>();
+        clang_getInclusions(unit, inclusionVisitor, reinterpret_cast<CXClientData>(&deps));
+        config.cache->store(header, allArgs, deps, result.info);
+    }
+
+    clang_disposeTranslationUnit(unit);
+    result.ok = true;
+    return result;
+}
+
+void mergeInfo(json& out, json& info) {
+    for (auto& section : info.items()) {
+        auto& dest = out[section.key()];
+        for (auto& entry : section.value().items()) {
+            if (dest.count(entry.key()) == 0) {
+                dest[entry.key()] = std::move(entry.value());
+            }
+        }
+    }
+}
+
+static bool statMTime(const std::string& path, struct timespec& mtime) {
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0) return false;
+    mtime = st.st_mtim;
+    return true;
+}
+
+static bool newerThan(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+// Identifies one build of a PCH. Renames keep both, so a .deps sidecar names the PCH it was written for.
+static std::string pchStamp(const std::string& pchPath) {
+    struct stat st {};
+    if (stat(pchPath.c_str(), &st) != 0) return std::string();
+    return std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec);
+}
+
+// The .deps sidecar holds the stamp of the PCH it belongs to, the args the PCH was built with (preceded by their
+// count), and then the files it depends on: the prefix header and everything it included. The PCH is up to date when
+// the stamp matches, it was built with args, and none of its dependencies are newer than it. deps is set to them.
+static bool readPchDeps(
+    const std::string& pchPath, const std::vector<std::string>& args, std::vector<std::string>& deps
+) {
+    auto stamp = pchStamp(pchPath);
+    if (stamp.empty()) return false;
+    struct timespec pchTime {};
+    statMTime(pchPath, pchTime);
+
+    std::ifstream depsFile(pchPath + ".deps");
+    std::string line;
+    if (!std::getline(depsFile, line) || line != stamp) return false;
+    if (!std::getline(depsFile, line) || line != std::to_string(args.size())) return false;
+    for (auto& arg : args) {
+        if (!std::getline(depsFile, line) || line != arg) return false;
+    }
+
+    deps.clear();
+    while (std::getline(depsFile, line)) {
+        struct timespec depTime {};
+        if (!statMTime(line, depTime) || newerThan(depTime, pchTime)) return false;
+        deps.push_back(line);
+    }
+    return true;
+}
+
+// Builds (or reuses from a previous run) a PCH for the include prefix shared by every header, so the system and SDK
+// headers it covers are only parsed once. Returns false if the PCH could not be built, and otherwise sets deps to the
+// files it depends on.
+static bool ensurePch(const Options& options, std::vector<std::string>& deps) {
+    if (readPchDeps(options.pchOut, options.clangArgs, deps)) return true;
+
+    std::vector<const char*> args;
+    for (auto& arg : options.clangArgs) {
+        args.push_back(arg.c_str());
+    }
+
+    CXIndex index = clang_createIndex(0, 0);
+
+    CXTranslationUnit unit;
+    auto err = clang_parseTranslationUnit2(
+        index,
+        options.pchPrefix.c_str(), args.data(), (int)args.size(),
+        nullptr, 0,
+        CXTranslationUnit_ForSerialization | CXTranslationUnit_Incomplete,
+        &unit
+    );
+
+    if (err != CXError_Success) {
+        cerr << "Unable to parse PCH prefix " << options.pchPrefix << ": " << err << endl;
+        clang_disposeIndex(index);
+        return false;
+    }
+
+    deps.clear();
+    clang_getInclusions(unit, inclusionVisitor, reinterpret_cast<CXClientData>(&deps));
+
+    // Publish through a rename so concurrent builds never pick up a half written PCH.
+    auto tmpPath = options.pchOut + ".tmp." + std::to_string(getpid());
+    auto saveErr = clang_saveTranslationUnit(unit, tmpPath.c_str(), clang_defaultSaveOptions(unit));
+    clang_disposeTranslationUnit(unit);
+    clang_disposeIndex(index);
+
+    if (saveErr != CXSaveError_None) {
+        cerr << "Unable to save PCH " << options.pchOut << ": " << saveErr << endl;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    std::ofstream depsFile(tmpPath + ".deps");
+    depsFile << pchStamp(tmpPath) << "\n" << options.clangArgs.size() << "\n";
+    for (auto& arg : options.clangArgs) {
+        depsFile << arg << "\n";
+    }
+    for (auto& dep : deps) {
+        depsFile << dep << "\n";
+    }
+    depsFile.close();
+
+    // The sidecar goes first. Until the PCH follows, its stamp does not match the PCH in place, so concurrent readers
+    // rebuild rather than pair either file with the other build's.
+    rename((tmpPath + ".deps").c_str(), (options.pchOut + ".deps").c_str());
+    rename(tmpPath.c_str(), options.pchOut.c_str());
+    return true;
+}
+
+static void remapTypeNode(json& node, const std::vector<size_t>& ids) {
+    for (auto key : {"pointee", "elementType", "valueType", "returnType"}) {
+        auto it = node.find(key);
+        if (it != node.end()) *it = ids[it->get<size_t>()];
+    }
+
+    auto args = node.find("argTypes");
+    if (args != node.end()) {
+        for (auto& arg : *args) arg = ids[arg.get<size_t>()];
+    }
+}
+
+// Rewrites every type reference outside the type table through ids.
+static void remapInfoTypes(json& info, const std::vector<size_t>& ids) {
+    for (auto& section : {"structs", "vars", "constants"}) {
+        auto entries = info.find(section);
+        if (entries == info.end()) continue;
+
+        for (auto& entry : *entries) {
+            if (entry.count("fields") != 0) {
+                for (auto& field : entry["fields"]) field["type"] = ids[field["type"].get<size_t>()];
+            } else if (entry.count("type") != 0) {
+                entry["type"] = ids[entry["type"].get<size_t>()];
+            } else {
+                remapTypeNode(entry, ids);
+            }
+        }
+    }
+
+    // Each typedef is the ID of its underlying type.
+    auto typedefs = info.find("typedefs");
+    if (typedefs != info.end()) {
+        for (auto& entry : *typedefs) entry = ids[entry.get<size_t>()];
+    }
+}
+
+// Type table entries only ever reference lower IDs, so a single pass in order is enough.
+void mergeTypes(TypeTable& types, json& info) {
+    auto local = info.find("types");
+    if (local == info.end()) return;
+
+    std::vector<size_t> ids;
+    for (auto& node : *local) {
+        remapTypeNode(node, ids);
+        ids.push_back(types.intern(std::move(node)));
+    }
+    info.erase(local);
+    remapInfoTypes(info, ids);
+}
+
+void mergeFiles(FileTable& files, json& info) {
+    auto local = info.find("files");
+    if (local == info.end()) return;
+
+    std::vector<size_t> ids;
+    for (auto& path : *local) {
+        ids.push_back(files.intern(path.get<std::string>()));
+    }
+    info.erase(local);
+
+    auto srcRefs = info.find("srcRefs");
+    if (srcRefs == info.end()) return;
+    for (auto& srcRef : *srcRefs) {
+        srcRef[0] = ids[srcRef[0].get<size_t>()];
+    }
+}
+
+// Turns a compile command into clang_parseTranslationUnit2 args: drops the compiler, the source file and the options
+// that only concern outputs, and makes relative paths resolve against the command's directory.
+static std::vector<std::string> compileCommandArgs(CXCompileCommand command, const std::string& directory) {
+    auto sourceFile = ClangString(clang_CompileCommand_getFilename(command)).str();
+
+    std::vector<std::string> args = {"-working-directory", directory};
+    auto nArgs = clang_CompileCommand_getNumArgs(command);
+    for (unsigned i = 1; i < nArgs; i++) {
+        auto arg = ClangString(clang_CompileCommand_getArg(command, i)).str();
+        if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+            i++;
+        } else if (arg == "-c" || arg == "-M" || arg == "-MM" || arg == "-MD" || arg == "-MMD" || arg == "-MP") {
+            continue;
+        } else if (arg == sourceFile) {
+            continue;
+        } else {
+            args.push_back(std::move(arg));
+        }
+    }
+    return args;
+}
+
+static bool loadCompilationDatabase(const std::string& dir, std::vector<Input>& inputs, std::string& error) {
+    CXCompilationDatabase_Error err;
+    auto database = clang_CompilationDatabase_fromDirectory(dir.c_str(), &err);
+    if (err != CXCompilationDatabase_NoError) {
+        error = "Unable to load compilation database from " + dir + ": " + std::to_string(err) + "\n";
+        return false;
+    }
+
+    auto commands = clang_CompilationDatabase_getAllCompileCommands(database);
+    for (unsigned i = 0, n = clang_CompileCommands_getSize(commands); i < n; i++) {
+        auto command = clang_CompileCommands_getCommand(commands, i);
+        auto directory = ClangString(clang_CompileCommand_getDirectory(command)).str();
+        auto file = ClangString(clang_CompileCommand_getFilename(command)).str();
+        if (!file.empty() && file[0] != '/') {
+            file = directory + "/" + file;
+        }
+        inputs.push_back({file, compileCommandArgs(command, directory)});
+    }
+
+    clang_CompileCommands_dispose(commands);
+    clang_CompilationDatabase_dispose(database);
+    return true;
+}
+
+static void typeNodeChildren(const json& node, std::vector<size_t>& children) {
+    for (auto key : {"pointee", "elementType", "valueType", "returnType"}) {
+        auto it = node.find(key);
+        if (it != node.end()) children.push_back(it->get<size_t>());
+    }
+
+    auto args = node.find("argTypes");
+    if (args != node.end()) {
+        for (auto& arg : *args) children.push_back(arg.get<size_t>());
+    }
+}
+
+static void sortObject(json& object) {
+    std::vector<std::string> keys;
+    for (auto& entry : object.items()) {
+        keys.push_back(entry.key());
+    }
+    std::sort(keys.begin(), keys.end());
+
+    json sorted = json::object();
+    for (auto& key : keys) {
+        sorted[key] = std::move(object[key]);
+    }
+    object = std::move(sorted);
+}
+
+// Renumbers the type table in first-use order over the sections, children before the types using them. Types no
+// declaration reaches are dropped unless keepUnused is set, in which case they go last.
+static void renumberTypes(json& out, bool keepUnused) {
+    auto types = out.find("types");
+    if (types == out.end()) return;
+
+    std::vector<size_t> ids(types->size(), SIZE_MAX);
+    json entries = json::array();
+    std::function<void(size_t)> visit = [&](size_t id) {
+        if (ids[id] != SIZE_MAX) return;
+        std::vector<size_t> children;
+        typeNodeChildren((*types)[id], children);
+        for (auto child : children) visit(child);
+        ids[id] = entries.size();
+        entries.push_back((*types)[id]);
+    };
+
+    std::vector<size_t> roots;
+    for (auto& section : {"structs", "vars", "constants"}) {
+        auto it = out.find(section);
+        if (it == out.end()) continue;
+        for (auto& entry : *it) {
+            if (entry.count("fields") != 0) {
+                for (auto& field : entry["fields"]) roots.push_back(field["type"].get<size_t>());
+            } else if (entry.count("type") != 0) {
+                roots.push_back(entry["type"].get<size_t>());
+            } else {
+                typeNodeChildren(entry, roots);
+            }
+        }
+    }
+    auto typedefs = out.find("typedefs");
+    if (typedefs != out.end()) {
+        for (auto& entry : *typedefs) roots.push_back(entry.get<size_t>());
+    }
+    for (auto root : roots) visit(root);
+    if (keepUnused) {
+        for (size_t id = 0; id < ids.size(); id++) visit(id);
+    }
+
+    for (auto& node : entries) remapTypeNode(node, ids);
+    *types = std::move(entries);
+    remapInfoTypes(out, ids);
+}
+
+// Renumbers the file table in first-use order over the srcRefs, dropping files none of them points into.
+static void renumberFiles(json& out) {
+    auto files = out.find("files");
+    auto srcRefs = out.find("srcRefs");
+    if (files == out.end()) return;
+
+    std::vector<size_t> ids(files->size(), SIZE_MAX);
+    json entries = json::array();
+    if (srcRefs != out.end()) {
+        for (auto& srcRef : *srcRefs) {
+            auto old = srcRef[0].get<size_t>();
+            if (ids[old] == SIZE_MAX) {
+                ids[old] = entries.size();
+                entries.push_back((*files)[old]);
+            }
+            srcRef[0] = ids[old];
+        }
+    }
+    *files = std::move(entries);
+}
+
+void canonicalizeOutput(json& out) {
+    if (!out.is_object()) return;
+
+    for (auto& section : {"structs", "vars", "constants", "typedefs", "srcRefs", "targets"}) {
+        auto it = out.find(section);
+        if (it != out.end()) sortObject(*it);
+    }
+
+    renumberTypes(out, true);
+    renumberFiles(out);
+}
+
+void compactTables(json& info) {
+    if (!info.is_object()) return;
+    renumberTypes(info, false);
+    renumberFiles(info);
+}
+
+std::vector<HeaderResult> extractHeaders(
+    const Options& options, const ResultCache* cache, StreamWriter* stream, TypeTable* streamTypes,
+    FileTable* streamFiles
+) {
+    auto config = extractConfig(options);
+    config.cache = cache;
+    config.stream = stream;
+    config.sharedTypes = stream ? streamTypes : nullptr;
+    config.sharedFiles = stream ? streamFiles : nullptr;
+    for (auto& file : options.unsavedFiles) {
+        config.unsavedFiles.push_back({file.path.c_str(), file.contents.data(), (unsigned long)file.contents.size()});
+    }
+
+    std::vector<Input> inputs;
+    std::unique_ptr<UsrClaims> claims;
+    if (!options.compdbDir.empty()) {
+        std::vector<HeaderResult> failed(1);
+        if (!loadCompilationDatabase(options.compdbDir, inputs, failed[0].diagnostics)) return failed;
+        claims = std::make_unique<UsrClaims>();
+        config.claims = claims.get();
+    }
+    // Compile commands bring their own -D, -I and -std, which the PCH was not built with, so only the headers parsed
+    // with the global args include it.
+    for (auto& header : options.headers) {
+        inputs.push_back({header, options.clangArgs, true});
+    }
+
+    if (!options.pchPrefix.empty()) {
+        if (ensurePch(options, config.pchDeps)) {
+            config.pchArgs = {"-include-pch", options.pchOut};
+        } else {
+            cerr << "Continuing without PCH" << endl;
+        }
+    }
+
+    std::vector<HeaderResult> results(inputs.size());
+    std::atomic<size_t> next(0);
+
+    // Each worker owns its own CXIndex; libclang is only thread safe across separate indices.
+    auto worker = [&]() {
+        CXIndex index = clang_createIndex(0, 0);
+        for (size_t i; (i = next++) < inputs.size();) {
+            results[i] = extractHeader(index, inputs[i], config);
+        }
+        clang_disposeIndex(index);
+    };
+
+    auto nThreads = stream ? 1 : std::min<size_t>(options.jobs, inputs.size());
+    if (nThreads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nThreads; i++) {
+            threads.emplace_back(worker);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    return results;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <clang-c/Index.h>
+#include "model.h"
+#include "output.h"
+#include "stats.h"
+
+class ElfExports;
+class ResultCache;
+
+class ClangString {
+public:
+    explicit ClangString(CXString string) : _string(string) {}
+
+    ~ClangString() {
+        clang_disposeString(_string);
+    }
+
+    ClangString(const ClangString&) = delete;
+    ClangString& operator=(const ClangString&) = delete;
+
+    std::string str() const {
+        return std::string(view());
+    }
+
+    const char* c_str() const {
+        return clang_getCString(_string);
+    }
+
+    // Borrows the string without copying it; only valid while this ClangString lives.
+    std::string_view view() const {
+        auto string = clang_getCString(_string);
+        return string ? std::string_view(string) : std::string_view();
+    }
+
+private:
+    CXString _string;
+};
+
+// Hash-consed table of type nodes. Types nested inside a node are stored as the ID of their own entry, so each
+// distinct type is expanded and emitted once and every use of it is a small integer.
+struct TypeTable {
+    json entries = json::array();
+    std::unordered_map<std::string, size_t> ids;
+
+    // Canonical type kind and spelling, to the ID the type was expanded to.
+    struct SpellingKey {
+        CXTypeKind kind;
+        std::string spelling;
+
+        bool operator==(const SpellingKey& other) const {
+            return kind == other.kind && spelling == other.spelling;
+        }
+    };
+
+    struct SpellingKeyHash {
+        size_t operator()(const SpellingKey& key) const {
+            return std::hash<std::string>()(key.spelling) * 31 + key.kind;
+        }
+    };
+
+    std::unordered_map<SpellingKey, size_t, SpellingKeyHash> spellings;
+
+    size_t intern(json node) {
+        auto key = node.dump();
+        auto it = ids.find(key);
+        if (it != ids.end()) return it->second;
+
+        auto id = entries.size();
+        entries.push_back(std::move(node));
+        ids.emplace(std::move(key), id);
+        return id;
+    }
+};
+
+// A header handed over in memory rather than read from disk. Its path is what #include directives and srcRefs see.
+struct UnsavedFile {
+    std::string path;
+    std::string contents;
+};
+
+// Interned source file paths. With --file-table, srcRefs hold [fileId, line, col, offset] tuples indexing this table
+// instead of a path string each.
+struct FileTable {
+    json entries = json::array();
+    std::unordered_map<std::string, size_t> ids;
+
+    size_t intern(const std::string& path) {
+        auto it = ids.find(path);
+        if (it != ids.end()) return it->second;
+
+        auto id = entries.size();
+        entries.push_back(path);
+        ids.emplace(path, id);
+        return id;
+    }
+};
+
+struct Options {
+    std::vector<std::string> headers;
+    std::vector<UnsavedFile> unsavedFiles;
+    std::vector<std::string> clangArgs = {
+        "-I/usr/lib/llvm-6.0/lib/clang/6.0.0/include/",
+        "-I/usr/lib/llvm-6.0/include/",
+    };
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::string pchPrefix;
+    std::string pchOut;
+    std::string cacheDir;
+    uint64_t cacheMaxBytes = 256ull << 20;
+    bool prune = false;
+    bool typeTable = false;
+    bool fileTable = false;
+    bool typedefRefs = false;
+    bool macros = false;
+    bool abi = false;
+    // Only functions this shared library exports are emitted, with their symbol versions.
+    std::shared_ptr<const ElfExports> exports;
+    bool stream = false;
+    OutputFormat format = OutputFormat::Json;
+    bool stats = false;
+    std::string compdbDir;
+};
+
+// Everything besides the clang args and the header contents that changes the extracted output. It salts the result
+// cache so entries written with different options never collide.
+std::string outputConfig(const Options& options);
+
+struct HeaderResult {
+    json info;
+    std::string diagnostics;
+    bool ok = false;
+    Stats stats;
+};
+
+// Extracts every header, and every translation unit of the compilation database if one was given. When stream is set,
+// declarations go straight to the writer in input order on a single thread instead of being returned in the results,
+// and every unit interns its types and files into streamTypes and streamFiles. Otherwise each result carries its own
+// type and file tables, which mergeTypes and mergeFiles combine.
+std::vector<HeaderResult> extractHeaders(
+    const Options& options, const ResultCache* cache, StreamWriter* stream, TypeTable* streamTypes,
+    FileTable* streamFiles
+);
+
+// Flags to parse translation units with for the given options.
+unsigned parseFlags(const Options& options);
+
+// Parses a translation unit that is kept alive and reparsed, for --serve and --watch. Returns null and sets error on
+// failure.
+CXTranslationUnit parseWarmUnit(
+    CXIndex index, const std::string& header, const std::vector<std::string>& args, const Options& options,
+    std::string& error
+);
+
+// Extracts an already parsed translation unit with the options' extraction settings, for callers that keep units
+// alive and reparse them. args are the ones the unit was parsed with. When files is given, only top-level declarations
+// located in one of them are visited.
+HeaderResult extractUnit(
+    CXTranslationUnit unit, const Options& options, const std::vector<std::string>& args,
+    const std::unordered_set<std::string>* files = nullptr
+);
+
+// Every file the unit included, the main file first.
+std::vector<std::string> unitInclusions(CXTranslationUnit unit);
+
+// Moves a header's own type table into the combined one and rewrites its type references to the combined IDs.
+void mergeTypes(TypeTable& types, json& info);
+
+// Moves a header's own file table into the combined one and rewrites its srcRefs to the combined IDs.
+void mergeFiles(FileTable& files, json& info);
+
+// Sorts the merged sections by name and renumbers the type and file tables in first-use order. Used when which worker emits a
+// declaration depends on scheduling, as with USR deduplication across a compilation database.
+void canonicalizeOutput(json& out);
+
+// Drops the entries of info's type and file tables that no declaration references any more, renumbering the rest.
+void compactTables(json& info);
+
+// Merges one header's output into the combined output. Entries already present win, so merging results in input
+// order gives the same output no matter which worker finished first.
+void mergeInfo(json& out, json& info);
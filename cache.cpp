@@ -0,0 +1,216 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Word at a time multiply-xorshift hash. Not cryptographic, it only needs to be fast and well distributed.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    uint64_t h = mix(seed ^ (size * 0x9e3779b97f4a7c15ULL));
+
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h = (h ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, bytes, size);
+    return mix(h ^ mix(tail));
+}
+
+static uint64_t hashString(const std::string& str, uint64_t seed) {
+    return hashBytes(str.data(), str.size(), seed);
+}
+
+static bool readFile(const std::string& path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool hashFile(const std::string& path, uint64_t& out) {
+    std::string contents;
+    if (!readFile(path, contents)) return false;
+    out = hashString(contents, 0);
+    return true;
+}
+
+// Age past which a temporary file in the cache directory is taken to belong to a run that died before publishing it.
+constexpr time_t staleTempSeconds = 60 * 60;
+
+// Writes to a temporary file next to the destination and renames it into place, so readers only ever see complete
+// entries. The temporary name is unique to the thread, as workers of one process can store the same key at once.
+static bool publishFile(const std::string& path, const void* data, size_t size) {
+    auto tmpPath = path + ".tmp." + std::to_string(getpid()) + "." +
+                   std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream out(tmpPath, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data), size);
+        if (!out) {
+            out.close();
+            unlink(tmpPath.c_str());
+            return false;
+        }
+    }
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+ResultCache::ResultCache(std::string dir, uint64_t maxBytes, std::string salt)
+    : _dir(std::move(dir)), _maxBytes(maxBytes), _salt(std::move(salt)) {
+    mkdir(_dir.c_str(), 0777);
+}
+
+std::string ResultCache::path(char prefix, uint64_t key) const {
+    char name[20];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return _dir + "/" + prefix + "-" + name;
+}
+
+// Key of everything known before parsing: the main header and the command line. It names the manifest that lists
+// the rest of the include closure.
+bool ResultCache::headerKey(const std::string& header, const std::vector<std::string>& args, uint64_t& key) const {
+    std::string contents;
+    if (!readFile(header, contents)) return false;
+
+    key = hashString(_salt, 0);
+    key = hashString(header, key);
+    for (auto& arg : args) {
+        key = hashString(arg, key);
+    }
+    key = hashString(contents, key);
+    return true;
+}
+
+bool ResultCache::lookup(const std::string& header, const std::vector<std::string>& args, json& out) const {
+    uint64_t key;
+    if (!headerKey(header, args, key)) return false;
+
+    auto manifestPath = path('m', key);
+    std::string manifestData;
+    if (!readFile(manifestPath, manifestData)) return false;
+
+    // The manifest holds one "<path>" line per included file; the result key covers the current content of each.
+    size_t pos = 0;
+    while (pos < manifestData.size()) {
+        auto end = manifestData.find('\n', pos);
+        if (end == std::string::npos) end = manifestData.size();
+        auto dep = manifestData.substr(pos, end - pos);
+        pos = end + 1;
+
+        uint64_t depHash;
+        if (!hashFile(dep, depHash)) return false;
+        key = hashString(dep, key) ^ depHash;
+    }
+
+    auto resultPath = path('r', key);
+    std::string resultData;
+    if (!readFile(resultPath, resultData)) return false;
+
+    // Bump the modification times, eviction treats them as the last use. Both files of the entry are bumped, as a
+    // result is unreachable without its manifest.
+    utimensat(AT_FDCWD, manifestPath.c_str(), nullptr, 0);
+    utimensat(AT_FDCWD, resultPath.c_str(), nullptr, 0);
+
+    out = json::from_cbor(resultData, true, false);
+    return !out.is_discarded();
+}
+
+void ResultCache::store(
+    const std::string& header, const std::vector<std::string>& args,
+    const std::vector<std::string>& deps, const json& info
+) const {
+    uint64_t key;
+    if (!headerKey(header, args, key)) return;
+
+    std::string manifestData;
+    auto resultKey = key;
+    for (auto& dep : deps) {
+        uint64_t depHash;
+        if (!hashFile(dep, depHash)) return;
+        resultKey = hashString(dep, resultKey) ^ depHash;
+        manifestData += dep;
+        manifestData += '\n';
+    }
+
+    auto cbor = json::to_cbor(info);
+    if (!publishFile(path('r', resultKey), cbor.data(), cbor.size())) return;
+    publishFile(path('m', key), manifestData.data(), manifestData.size());
+}
+
+void ResultCache::evict() const {
+    auto lockPath = _dir + "/lock";
+    int lockFd = open(lockPath.c_str(), O_CREAT | O_RDWR, 0666);
+    if (lockFd < 0) return;
+
+    // Another process already evicting will bring the cache under the cap, there is no point in waiting for it.
+    if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+        close(lockFd);
+        return;
+    }
+
+    struct Entry {
+        std::string path;
+        struct timespec mtime;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    if (DIR* dir = opendir(_dir.c_str())) {
+        while (dirent* ent = readdir(dir)) {
+            if ((ent->d_name[0] != 'r' && ent->d_name[0] != 'm') || ent->d_name[1] != '-') continue;
+            auto entPath = _dir + "/" + ent->d_name;
+            struct stat st {};
+            if (stat(entPath.c_str(), &st) != 0) continue;
+            // Temporary files may be another process still writing an entry; only those left behind by a run that
+            // died an hour or more ago are removed.
+            if (strstr(ent->d_name, ".tmp.") != nullptr) {
+                if (time(nullptr) - st.st_mtim.tv_sec >= staleTempSeconds) unlink(entPath.c_str());
+                continue;
+            }
+            entries.push_back({entPath, st.st_mtim, (uint64_t)st.st_size});
+            total += st.st_size;
+        }
+        closedir(dir);
+    }
+
+    if (total > _maxBytes) {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            if (a.mtime.tv_sec != b.mtime.tv_sec) return a.mtime.tv_sec < b.mtime.tv_sec;
+            return a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+
+        // Evict down to 90% of the cap so every run near the limit does not have to rescan the directory.
+        auto target = _maxBytes - _maxBytes / 10;
+        for (auto& entry : entries) {
+            if (total <= target) break;
+            if (unlink(entry.path.c_str()) == 0) {
+                total -= entry.size;
+            }
+        }
+    }
+
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+}
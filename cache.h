@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "model.h"
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// On-disk cache of extraction results, keyed by the content of the header, every file it includes, the clang args and
+// a salt (the libclang version and any option that changes the output). Safe to share between concurrent processes:
+// entries are published with an atomic rename and eviction is serialized with a lock file.
+class ResultCache {
+public:
+    ResultCache(std::string dir, uint64_t maxBytes, std::string salt);
+
+    bool lookup(const std::string& header, const std::vector<std::string>& args, json& out) const;
+
+    void store(
+        const std::string& header, const std::vector<std::string>& args,
+        const std::vector<std::string>& deps, const json& info
+    ) const;
+
+    // Deletes least recently used entries until the cache fits in maxBytes.
+    void evict() const;
+
+private:
+    bool headerKey(const std::string& header, const std::vector<std::string>& args, uint64_t& key) const;
+    std::string path(char prefix, uint64_t key) const;
+
+    std::string _dir;
+    uint64_t _maxBytes;
+    std::string _salt;
+};
@@ -0,0 +1,243 @@
+#include "exports.h"
+
+#include <cerrno>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct Elf32 {
+    using Ehdr = Elf32_Ehdr;
+    using Shdr = Elf32_Shdr;
+    using Sym = Elf32_Sym;
+    using BloomWord = uint32_t;
+};
+
+struct Elf64 {
+    using Ehdr = Elf64_Ehdr;
+    using Shdr = Elf64_Shdr;
+    using Sym = Elf64_Sym;
+    using BloomWord = uint64_t;
+};
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+constexpr unsigned char hostData = ELFDATA2LSB;
+#else
+constexpr unsigned char hostData = ELFDATA2MSB;
+#endif
+
+// .gnu.version entries: the version index, and the bit marking a version that is not the symbol's default.
+constexpr uint16_t versymIndex = 0x7fff;
+constexpr uint16_t versymHidden = 0x8000;
+
+// The hash .gnu.hash tables are built with.
+uint32_t gnuHash(std::string_view name) {
+    uint32_t hash = 5381;
+    for (unsigned char c : name) {
+        hash = hash * 33 + c;
+    }
+    return hash;
+}
+
+// Copies a T out of the mapping, which makes no promise about alignment. Fails when it would read past the end.
+template<typename T>
+bool read(const unsigned char* data, size_t size, size_t offset, T& out) {
+    if (offset > size || size - offset < sizeof(T)) return false;
+    memcpy(&out, data + offset, sizeof(T));
+    return true;
+}
+
+// Functions other objects can bind to: defined here, global or weak, and not hidden.
+template<typename Sym>
+bool isExportedFunction(const Sym& sym) {
+    auto type = ELF64_ST_TYPE(sym.st_info);
+    auto bind = ELF64_ST_BIND(sym.st_info);
+    auto visibility = ELF64_ST_VISIBILITY(sym.st_other);
+    return sym.st_shndx != SHN_UNDEF && (type == STT_FUNC || type == STT_GNU_IFUNC) &&
+           (bind == STB_GLOBAL || bind == STB_WEAK) && (visibility == STV_DEFAULT || visibility == STV_PROTECTED);
+}
+
+}
+
+std::unique_ptr<ElfExports> ElfExports::load(const std::string& path, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "Unable to open " + path + ": " + strerror(errno);
+        return nullptr;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)EI_NIDENT) {
+        close(fd);
+        error = path + " is not an ELF file";
+        return nullptr;
+    }
+
+    auto mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "Unable to map " + path + ": " + strerror(errno);
+        return nullptr;
+    }
+
+    std::unique_ptr<ElfExports> exports(new ElfExports());
+    exports->_data = static_cast<const unsigned char*>(mapping);
+    exports->_size = st.st_size;
+    exports->_identity = path + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." +
+                         std::to_string(st.st_mtim.tv_nsec);
+
+    auto ident = exports->_data;
+    if (memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        error = path + " is not an ELF file";
+        return nullptr;
+    }
+    if (ident[EI_DATA] != hostData) {
+        error = path + " does not have the host's byte order";
+        return nullptr;
+    }
+
+    exports->_is64 = ident[EI_CLASS] == ELFCLASS64;
+    bool parsed = exports->_is64 ? exports->parse<Elf64>(error) : exports->parse<Elf32>(error);
+    if (!parsed) {
+        error = path + ": " + error;
+        return nullptr;
+    }
+    return exports;
+}
+
+ElfExports::~ElfExports() {
+    if (_data) munmap(const_cast<unsigned char*>(_data), _size);
+}
+
+template<typename Elf>
+bool ElfExports::parse(std::string& error) {
+    typename Elf::Ehdr ehdr;
+    if (!read(_data, _size, 0, ehdr) || ehdr.e_type != ET_DYN) {
+        error = "not a shared library";
+        return false;
+    }
+
+    // .bss and friends take no space in the file, so only sections with contents are bounds-checked.
+    auto section = [&](size_t index, typename Elf::Shdr& shdr) {
+        return index < ehdr.e_shnum && read(_data, _size, ehdr.e_shoff + index * ehdr.e_shentsize, shdr) &&
+               (shdr.sh_type == SHT_NOBITS || (shdr.sh_offset <= _size && _size - shdr.sh_offset >= shdr.sh_size));
+    };
+
+    for (size_t i = 0; i < ehdr.e_shnum; i++) {
+        typename Elf::Shdr shdr;
+        if (!section(i, shdr)) {
+            error = "truncated section headers";
+            return false;
+        }
+
+        typename Elf::Shdr link;
+        if (shdr.sh_type == SHT_DYNSYM && section(shdr.sh_link, link)) {
+            _dynsym = shdr.sh_offset;
+            _dynsymCount = shdr.sh_size / sizeof(typename Elf::Sym);
+            _dynstr = link.sh_offset;
+            _dynstrSize = link.sh_size;
+        } else if (shdr.sh_type == SHT_GNU_HASH) {
+            _gnuHash = shdr.sh_offset;
+        } else if (shdr.sh_type == SHT_GNU_versym) {
+            _versym = shdr.sh_offset;
+        } else if (shdr.sh_type == SHT_GNU_verdef && section(shdr.sh_link, link)) {
+            // Verdef entries have the same layout in both classes. The base entry names the file, not a version.
+            size_t offset = shdr.sh_offset;
+            for (size_t n = 0; n < shdr.sh_info; n++) {
+                Elf64_Verdef verdef;
+                Elf64_Verdaux verdaux;
+                if (!read(_data, _size, offset, verdef) || !read(_data, _size, offset + verdef.vd_aux, verdaux)) break;
+                if (!(verdef.vd_flags & VER_FLG_BASE) && verdaux.vda_name < link.sh_size) {
+                    auto name = reinterpret_cast<const char*>(_data + link.sh_offset + verdaux.vda_name);
+                    _versions[verdef.vd_ndx] = std::string(name, strnlen(name, link.sh_size - verdaux.vda_name));
+                }
+                if (verdef.vd_next == 0) break;
+                offset += verdef.vd_next;
+            }
+        }
+    }
+
+    if (_dynsym == 0) {
+        error = "no dynamic symbol table";
+        return false;
+    }
+
+    // Without a GNU hash table (only very old or unusually linked libraries), fall back to an index of every name.
+    if (_gnuHash == 0) {
+        for (size_t i = 0; i < _dynsymCount; i++) {
+            typename Elf::Sym sym;
+            if (!read(_data, _size, _dynsym + i * sizeof(sym), sym) || sym.st_name >= _dynstrSize) continue;
+            auto name = reinterpret_cast<const char*>(_data + _dynstr + sym.st_name);
+            _symbols.emplace(std::string_view(name, strnlen(name, _dynstrSize - sym.st_name)), i);
+        }
+    }
+    return true;
+}
+
+bool ElfExports::find(std::string_view symbol, std::string& version) const {
+    return _is64 ? findIn<Elf64>(symbol, version) : findIn<Elf32>(symbol, version);
+}
+
+template<typename Elf>
+bool ElfExports::findIn(std::string_view symbol, std::string& version) const {
+    // A symbol can be exported under several versions. The default one is what dlsym and the linker bind to, so its
+    // version is preferred over hidden ones.
+    bool found = false;
+    bool foundDefault = false;
+    auto consider = [&](size_t index) {
+        typename Elf::Sym sym;
+        if (!read(_data, _size, _dynsym + index * sizeof(sym), sym) || !isExportedFunction(sym)) return;
+        if (sym.st_name >= _dynstrSize) return;
+        auto name = reinterpret_cast<const char*>(_data + _dynstr + sym.st_name);
+        if (std::string_view(name, strnlen(name, _dynstrSize - sym.st_name)) != symbol) return;
+
+        uint16_t versym = 1;
+        if (_versym != 0) read(_data, _size, _versym + index * sizeof(versym), versym);
+        bool hidden = (versym & versymHidden) != 0;
+        if (found && (foundDefault || hidden)) return;
+
+        found = true;
+        foundDefault = !hidden;
+        auto it = _versions.find(versym & versymIndex);
+        version = it == _versions.end() ? std::string() : it->second;
+    };
+
+    if (_gnuHash == 0) {
+        auto it = _symbols.find(symbol);
+        if (it != _symbols.end()) consider(it->second);
+        return found;
+    }
+
+    uint32_t header[4];
+    if (!read(_data, _size, _gnuHash, header)) return false;
+    auto [bucketCount, symOffset, bloomSize, bloomShift] = header;
+    if (bucketCount == 0 || bloomSize == 0) return false;
+
+    // The bloom filter rules out most names that are not in the table without touching the buckets.
+    using BloomWord = typename Elf::BloomWord;
+    constexpr uint32_t bloomBits = sizeof(BloomWord) * 8;
+    auto hash = gnuHash(symbol);
+    BloomWord word;
+    size_t bloom = _gnuHash + sizeof(header);
+    if (!read(_data, _size, bloom + (hash / bloomBits) % bloomSize * sizeof(BloomWord), word)) return false;
+    BloomWord mask = (BloomWord(1) << (hash % bloomBits)) | (BloomWord(1) << ((hash >> bloomShift) % bloomBits));
+    if ((word & mask) != mask) return false;
+
+    size_t buckets = bloom + bloomSize * sizeof(BloomWord);
+    size_t chains = buckets + bucketCount * sizeof(uint32_t);
+    uint32_t index;
+    if (!read(_data, _size, buckets + hash % bucketCount * sizeof(uint32_t), index) || index < symOffset) return false;
+
+    // Symbols sharing a bucket are consecutive, and the last one's chain entry has the low bit set.
+    for (; index < _dynsymCount; index++) {
+        uint32_t chainHash;
+        if (!read(_data, _size, chains + (index - symOffset) * sizeof(uint32_t), chainHash)) break;
+        if ((chainHash | 1) == (hash | 1)) consider(index);
+        if (chainHash & 1) break;
+    }
+    return found;
+}
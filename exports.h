@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// The functions an ELF shared library exports, read straight from its .dynsym. Names are looked up through the
+// library's .gnu.hash table when it has one, so nothing is indexed up front. Lookups are read-only and safe from every
+// worker thread.
+class ElfExports {
+public:
+    // Maps the library at path. Returns null and sets error when it is not an ELF shared library of the host's byte
+    // order, or has no dynamic symbol table.
+    static std::unique_ptr<ElfExports> load(const std::string& path, std::string& error);
+
+    ~ElfExports();
+
+    ElfExports(const ElfExports&) = delete;
+    ElfExports& operator=(const ElfExports&) = delete;
+
+    // Whether the library defines and exports a function of this symbol name. version is set to the name of the
+    // symbol's default version, or left empty when it is unversioned.
+    bool find(std::string_view symbol, std::string& version) const;
+
+    // The library's path, size and modification time, which salt the result cache.
+    const std::string& identity() const {
+        return _identity;
+    }
+
+private:
+    ElfExports() = default;
+
+    template<typename Elf>
+    bool parse(std::string& error);
+
+    template<typename Elf>
+    bool findIn(std::string_view symbol, std::string& version) const;
+
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+    bool _is64 = false;
+    std::string _identity;
+
+    // Offsets into the mapping, or 0 for tables the library does not have.
+    size_t _dynsym = 0;
+    size_t _dynsymCount = 0;
+    size_t _dynstr = 0;
+    size_t _dynstrSize = 0;
+    size_t _gnuHash = 0;
+    size_t _versym = 0;
+
+    // Version index to version name, from .gnu.version_d.
+    std::unordered_map<unsigned, std::string> _versions;
+
+    // Only built for libraries without .gnu.hash: symbol name to its .dynsym index.
+    std::unordered_map<std::string_view, size_t> _symbols;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Insertion-ordered map with string keys, shaped to plug into basic_json as its ObjectType. Entries live in one
+// contiguous vector; objects with more than a handful of keys also get an open-addressing index of entry positions.
+// Iteration order is insertion order, so output built from it is deterministic without sorting.
+template<typename Key, typename T, typename Compare = std::less<Key>,
+         typename Allocator = std::allocator<std::pair<const Key, T>>>
+class FlatMap {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using key_compare = Compare;
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<value_type>;
+
+private:
+    using Storage = std::vector<value_type, allocator_type>;
+    using IndexAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<uint32_t>;
+
+    // Below this size a linear scan beats hashing the key.
+    static constexpr size_t indexThreshold = 8;
+
+public:
+    using size_type = typename Storage::size_type;
+    using difference_type = typename Storage::difference_type;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using iterator = typename Storage::iterator;
+    using const_iterator = typename Storage::const_iterator;
+
+    FlatMap() = default;
+
+    template<typename InputIt>
+    FlatMap(InputIt first, InputIt last) {
+        insert(first, last);
+    }
+
+    FlatMap(std::initializer_list<value_type> init) : FlatMap(init.begin(), init.end()) {}
+
+    iterator begin() noexcept { return _entries.begin(); }
+    const_iterator begin() const noexcept { return _entries.begin(); }
+    const_iterator cbegin() const noexcept { return _entries.cbegin(); }
+    iterator end() noexcept { return _entries.end(); }
+    const_iterator end() const noexcept { return _entries.end(); }
+    const_iterator cend() const noexcept { return _entries.cend(); }
+
+    bool empty() const noexcept { return _entries.empty(); }
+    size_type size() const noexcept { return _entries.size(); }
+    size_type max_size() const noexcept { return std::min<size_type>(_entries.max_size(), UINT32_MAX - 1); }
+
+    void clear() noexcept {
+        _entries.clear();
+        _index.clear();
+    }
+
+    template<typename K>
+    iterator find(const K& key) {
+        return _entries.begin() + position(key);
+    }
+
+    template<typename K>
+    const_iterator find(const K& key) const {
+        return _entries.begin() + position(key);
+    }
+
+    template<typename K>
+    size_type count(const K& key) const {
+        return position(key) != _entries.size() ? 1 : 0;
+    }
+
+    template<typename K>
+    T& at(const K& key) {
+        auto pos = position(key);
+        if (pos == _entries.size()) throw std::out_of_range("FlatMap::at");
+        return _entries[pos].second;
+    }
+
+    template<typename K>
+    const T& at(const K& key) const {
+        auto pos = position(key);
+        if (pos == _entries.size()) throw std::out_of_range("FlatMap::at");
+        return _entries[pos].second;
+    }
+
+    T& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+
+    T& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&& ... args) {
+        auto pos = position(key);
+        if (pos != _entries.size()) return {_entries.begin() + pos, false};
+
+        _entries.emplace_back(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        indexLast();
+        return {_entries.end() - 1, true};
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&& ... args) {
+        value_type value(std::forward<Args>(args)...);
+        auto pos = position(value.first);
+        if (pos != _entries.size()) return {_entries.begin() + pos, false};
+
+        _entries.push_back(std::move(value));
+        indexLast();
+        return {_entries.end() - 1, true};
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return emplace(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return emplace(std::move(value));
+    }
+
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            emplace(*first);
+        }
+    }
+
+    // Erasing shifts later entries down to keep insertion order, and rebuilds the index. The extractor only erases
+    // rarely, so this is not worth a tombstone scheme.
+    iterator erase(iterator pos) {
+        return erase(const_iterator(pos));
+    }
+
+    iterator erase(const_iterator pos) {
+        auto offset = pos - _entries.cbegin();
+        _entries.erase(pos);
+        reindex();
+        return _entries.begin() + offset;
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        auto offset = first - _entries.cbegin();
+        _entries.erase(first, last);
+        reindex();
+        return _entries.begin() + offset;
+    }
+
+    template<typename K, typename = std::enable_if_t<std::is_convertible<const K&, std::string_view>::value>>
+    size_type erase(const K& key) {
+        auto pos = position(key);
+        if (pos == _entries.size()) return 0;
+        erase(_entries.cbegin() + pos);
+        return 1;
+    }
+
+    friend bool operator==(const FlatMap& lhs, const FlatMap& rhs) {
+        if (lhs.size() != rhs.size()) return false;
+        for (auto& entry : lhs._entries) {
+            auto pos = rhs.position(entry.first);
+            if (pos == rhs._entries.size() || !(rhs._entries[pos].second == entry.second)) return false;
+        }
+        return true;
+    }
+
+    friend bool operator!=(const FlatMap& lhs, const FlatMap& rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator<(const FlatMap& lhs, const FlatMap& rhs) {
+        return lhs._entries < rhs._entries;
+    }
+
+private:
+    static size_t hash(std::string_view key) {
+        return std::hash<std::string_view>()(key);
+    }
+
+    // Position of key in _entries, or _entries.size() if it is not present.
+    template<typename K>
+    size_t position(const K& key) const {
+        std::string_view view(key);
+        if (_index.empty()) {
+            for (size_t i = 0; i < _entries.size(); i++) {
+                if (std::string_view(_entries[i].first) == view) return i;
+            }
+            return _entries.size();
+        }
+
+        auto mask = _index.size() - 1;
+        for (auto slot = hash(view) & mask;; slot = (slot + 1) & mask) {
+            auto entry = _index[slot];
+            if (entry == 0) return _entries.size();
+            if (std::string_view(_entries[entry - 1].first) == view) return entry - 1;
+        }
+    }
+
+    void place(size_t pos) {
+        auto mask = _index.size() - 1;
+        auto slot = hash(_entries[pos].first) & mask;
+        while (_index[slot] != 0) slot = (slot + 1) & mask;
+        _index[slot] = (uint32_t)pos + 1;
+    }
+
+    // Keeps the index at most half full; slots hold entry position + 1 so zero means empty.
+    void indexLast() {
+        if (_entries.size() <= indexThreshold) return;
+        if (_entries.size() * 2 > _index.size()) {
+            reindex();
+        } else {
+            place(_entries.size() - 1);
+        }
+    }
+
+    void reindex() {
+        _index.clear();
+        if (_entries.size() <= indexThreshold) return;
+
+        size_t capacity = 16;
+        while (capacity < _entries.size() * 4) capacity *= 2;
+        _index.assign(capacity, 0);
+        for (size_t i = 0; i < _entries.size(); i++) place(i);
+    }
+
+    Storage _entries;
+    std::vector<uint32_t, IndexAllocator> _index;
+};
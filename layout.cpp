@@ -0,0 +1,219 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+
+namespace {
+
+constexpr int64_t cacheLineBytes = 64;
+
+struct Field {
+    std::string name;
+    int64_t offset;
+    int64_t size;
+    int64_t align;
+    // The space it takes when moved: its size, or whole storage units for a run of bitfields sharing its units with the
+    // fields around it.
+    int64_t storage;
+};
+
+// Padding before fields[next], or after the last field when next is the field count.
+struct Hole {
+    size_t next;
+    int64_t size;
+};
+
+struct StructLayout {
+    std::string name;
+    // The records of anonymous union members, whose fields all start at zero.
+    bool isUnion = false;
+    int64_t size = 0;
+    int64_t align = 1;
+    std::vector<Field> fields;
+    std::vector<Hole> holes;
+    std::vector<size_t> straddling;
+    int64_t wasted = 0;
+
+    // Overlapping fields and fields placed below their natural alignment (packed structs) are laid out as written, so
+    // no other order is suggested for them.
+    bool reorderable = true;
+    std::vector<size_t> order;
+    int64_t reorderedSize = 0;
+};
+
+int64_t alignUp(int64_t value, int64_t align) {
+    return align > 1 ? (value + align - 1) / align * align : value;
+}
+
+int64_t intValue(const json& object, const char* key, int64_t fallback) {
+    auto it = object.find(key);
+    if (it == object.end() || !it->is_number_integer()) return fallback;
+    return it->get<int64_t>();
+}
+
+StructLayout analyze(const std::string& name, const json& entry) {
+    StructLayout layout;
+    layout.name = name;
+    layout.size = std::max<int64_t>(0, intValue(entry, "size", 0));
+    layout.align = std::max<int64_t>(1, intValue(entry, "align", 1));
+    layout.isUnion = entry.value("union", false);
+    layout.reorderable = !entry.value("packed", false) && !layout.isUnion;
+
+    auto fields = entry.find("fields");
+    if (fields != entry.end()) {
+        for (size_t i = 0; i < fields->size(); i++) {
+            auto& field = (*fields)[i];
+            if (field.find("bitWidth") == field.end()) {
+                // Anonymous struct and union members come without a name, and flexible array members report a
+                // negative size.
+                auto name = field.value("name", std::string());
+                auto size = std::max<int64_t>(0, intValue(field, "size", 0));
+                layout.fields.push_back({
+                    name.empty() ? "(anonymous)" : name,
+                    std::max<int64_t>(0, intValue(field, "offset", 0)),
+                    size,
+                    std::max<int64_t>(1, intValue(field, "align", 1)),
+                    size,
+                });
+                continue;
+            }
+
+            // A run of adjacent bitfields can only be moved as a whole, so it becomes one field spanning the storage
+            // units its bits are in, clipped to whatever surrounds it.
+            size_t last = i;
+            while (last + 1 < fields->size() && (*fields)[last + 1].find("bitWidth") != (*fields)[last + 1].end()) {
+                last++;
+            }
+            std::string name;
+            int64_t align = 1;
+            int64_t bitEnd = 0;
+            for (size_t j = i; j <= last; j++) {
+                auto& bits = (*fields)[j];
+                auto width = std::max<int64_t>(0, intValue(bits, "bitWidth", 0));
+                name += (name.empty() ? "" : " ") + bits.value("name", std::string()) + ":" + std::to_string(width);
+                align = std::max(align, intValue(bits, "align", 1));
+                bitEnd = std::max(bitEnd, intValue(bits, "bitOffset", 0) + width);
+            }
+
+            int64_t previousEnd = layout.fields.empty() ? 0 : layout.fields.back().offset + layout.fields.back().size;
+            int64_t nextOffset = last + 1 < fields->size() ? intValue((*fields)[last + 1], "offset", 0) : layout.size;
+            int64_t unitStart = std::max<int64_t>(0, intValue(field, "bitOffset", 0)) / 8 / align * align;
+            int64_t unitEnd = alignUp((bitEnd + 7) / 8, align);
+            int64_t start = std::max(previousEnd, unitStart);
+            int64_t end = std::max(start, std::min(nextOffset, unitEnd));
+            layout.fields.push_back({name, start, end - start, align, std::max<int64_t>(0, unitEnd - unitStart)});
+            i = last;
+        }
+    }
+
+    int64_t end = 0;
+    for (size_t i = 0; i < layout.fields.size(); i++) {
+        auto& field = layout.fields[i];
+        // Bitfield runs clipped to the fields around them start wherever the previous field ends.
+        bool clipped = field.storage != field.size;
+        if (field.offset < end || (field.offset % field.align != 0 && !clipped)) {
+            layout.reorderable = false;
+        } else if (field.offset > end) {
+            layout.holes.push_back({i, field.offset - end});
+        }
+        end = std::max(end, field.offset + field.size);
+
+        if (field.size > 0 && field.size <= cacheLineBytes &&
+            field.offset / cacheLineBytes != (field.offset + field.size - 1) / cacheLineBytes) {
+            layout.straddling.push_back(i);
+        }
+    }
+    if (layout.size > end) {
+        layout.holes.push_back({layout.fields.size(), layout.size - end});
+    }
+    for (auto& hole : layout.holes) {
+        layout.wasted += hole.size;
+    }
+
+    if (!layout.reorderable || layout.fields.empty()) return layout;
+
+    // Placing fields by decreasing alignment leaves no hole between them when every size is a multiple of its
+    // alignment, which holds for everything but packed records.
+    layout.order.resize(layout.fields.size());
+    std::iota(layout.order.begin(), layout.order.end(), 0);
+    std::stable_sort(layout.order.begin(), layout.order.end(), [&](size_t a, size_t b) {
+        auto& fa = layout.fields[a];
+        auto& fb = layout.fields[b];
+        return fa.align != fb.align ? fa.align > fb.align : fa.storage > fb.storage;
+    });
+
+    int64_t offset = 0;
+    for (auto i : layout.order) {
+        offset = alignUp(offset, layout.fields[i].align) + layout.fields[i].storage;
+    }
+    layout.reorderedSize = alignUp(offset, layout.align);
+    return layout;
+}
+
+void printStruct(std::ostream& os, const StructLayout& layout) {
+    auto comment = [&](const std::string& text) {
+        os << "    /* " << text << " */\n";
+    };
+
+    os << (layout.isUnion ? "union " : "struct ") << layout.name << " { /* size: " << layout.size << ", align: " << layout.align << " */\n";
+
+    auto hole = layout.holes.begin();
+    for (size_t i = 0; i <= layout.fields.size(); i++) {
+        for (; hole != layout.holes.end() && hole->next == i; ++hole) {
+            comment("XXX " + std::to_string(hole->size) + " bytes " +
+                    (i == layout.fields.size() ? "of trailing padding" : "hole"));
+        }
+        if (i == layout.fields.size()) break;
+
+        auto& field = layout.fields[i];
+        os << "    " << std::left << std::setw(40) << field.name << std::right << " /* " << std::setw(6) << field.offset
+           << std::setw(6) << field.size << " */";
+        if (std::find(layout.straddling.begin(), layout.straddling.end(), i) != layout.straddling.end()) {
+            os << " /* crosses cache line " << field.offset / cacheLineBytes << " */";
+        }
+        os << "\n";
+    }
+
+    if (layout.wasted > 0) {
+        comment("wasted: " + std::to_string(layout.wasted) + " of " + std::to_string(layout.size) + " bytes");
+    }
+    if (layout.reorderable && layout.reorderedSize < layout.size) {
+        std::string order;
+        for (auto i : layout.order) {
+            order += (order.empty() ? "" : ", ") + layout.fields[i].name;
+        }
+        comment("reordering as " + order + " saves " + std::to_string(layout.size - layout.reorderedSize) +
+                " bytes (" + std::to_string(layout.size) + " -> " + std::to_string(layout.reorderedSize) + ")");
+    }
+    os << "};\n\n";
+}
+
+}
+
+void printLayoutReport(std::ostream& os, const json& out) {
+    std::vector<StructLayout> layouts;
+    auto structs = out.find("structs");
+    if (structs != out.end()) {
+        for (auto& entry : structs->items()) {
+            layouts.push_back(analyze(entry.key(), entry.value()));
+        }
+    }
+
+    std::stable_sort(layouts.begin(), layouts.end(), [](const StructLayout& a, const StructLayout& b) {
+        return a.wasted != b.wasted ? a.wasted > b.wasted : a.name < b.name;
+    });
+
+    int64_t wasted = 0;
+    int64_t savings = 0;
+    size_t padded = 0;
+    for (auto& layout : layouts) {
+        printStruct(os, layout);
+        wasted += layout.wasted;
+        padded += layout.wasted > 0;
+        if (layout.reorderable) savings += std::max<int64_t>(0, layout.size - layout.reorderedSize);
+    }
+
+    os << layouts.size() << " structs, " << padded << " with padding, " << wasted << " bytes wasted, " << savings
+       << " bytes recoverable by reordering" << std::endl;
+}
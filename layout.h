@@ -0,0 +1,9 @@
+#pragma once
+
+#include <ostream>
+#include "model.h"
+
+// Prints a pahole style report of the layout of every struct in out: its alignment, the padding holes between its
+// fields and after the last one, the fields straddling a 64-byte cache line, and a field order that minimizes padding
+// along with the bytes it saves. Structs are ranked by the bytes they waste, worst first.
+void printLayoutReport(std::ostream& os, const json& out);
@@ -1,281 +1,312 @@
+#include <cerrno>
+#include <cstring>
 #include <iostream>
-#include <clang-c/Index.h>
-#include <map>
-#include <fstream>
-#include "json.hpp"
+#include <iterator>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include "abi.h"
+#include "bindgen.h"
+#include "cache.h"
+#include "exports.h"
+#include "layout.h"
+#include "output.h"
+#include "server.h"
+#include "watch.h"
+#include "stats.h"
 
-using json = nlohmann::json;
-
-using std::cout;
 using std::cerr;
 using std::endl;
 
-class ClangString {
-public:
-    explicit ClangString(CXString string) : _string(string) {}
-
-    ~ClangString() {
-        clang_disposeString(_string);
-    }
+// Path stdin is parsed as when given as "-". The .h extension makes clang treat it as a C header.
+static const char* stdinHeaderPath = "stdin.h";
 
-    std::string str() {
-        return c_str();
-    }
+// Reads the in-memory headers of --stdin-json: an array of {"path": ..., "contents": ...} objects.
+static bool parseUnsavedFiles(const std::string& input, std::vector<UnsavedFile>& files) {
+    auto parsed = json::parse(input, nullptr, false);
+    if (parsed.is_discarded() || !parsed.is_array()) return false;
 
-    const char* c_str() {
-        return clang_getCString(_string);
+    for (auto& entry : parsed) {
+        if (!entry.is_object()) return false;
+        auto path = entry.find("path");
+        auto contents = entry.find("contents");
+        if (path == entry.end() || !path->is_string() || contents == entry.end() || !contents->is_string()) {
+            return false;
+        }
+        files.push_back({path->get<std::string>(), contents->get<std::string>()});
     }
-
-private:
-    CXString _string;
-};
-
-static bool isForwardDecl(CXCursor cursor)  {
-    auto definition = clang_getCursorDefinition(cursor);
-    if (clang_equalCursors(definition, clang_getNullCursor()))
-        return true;
-    return !clang_equalCursors(cursor, definition);
+    return true;
 }
 
-std::string getTypeSpelling(CXType type) {
-    auto ncursor = clang_getTypeDeclaration(type);
-    auto nstr = ClangString(clang_getCursorDisplayName(ncursor)).str();
-    return nstr.empty() ? ClangString(clang_getTypeSpelling(type)).str() : nstr;
+void usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " [-j N] [-I<dir>] [-D<macro>] [--target=<triple>] [--prune] [--type-table]"
+         << " [--file-table] [--typedefs] [--macros] [--stream] [--analyze-layout] [--abi] [--exports <lib.so>]"
+         << " [--format json|cbor|msgpack|ubjson|bson] [--stats] [--compdb <dir>] [--pch <prefix.h>] [--pch-out <file>]"
+         << " [--cache-dir <dir>] [--cache-max-size <bytes>] [--serve <socket>] [--watch] [--stdin-json] [header...|-]" << endl;
 }
 
-std::string getTypedefName(CXType type) {
-    ClangString str(clang_getTypedefName(type));
-    return str.str();
-}
-
-std::string getCursorSpelling(CXCursor cursor) {
-    ClangString cursorSpelling(clang_getCursorSpelling(cursor));
-    return cursorSpelling.str();
-}
-
-static bool isAnonymousType(CXCursor cursor)  {
-    if (clang_Cursor_isAnonymous(cursor)) return true;
-    auto type = clang_getCursorType(cursor);
-    return getTypeSpelling(type).find("::(anonymous") != std::string::npos;
-}
-
-int64_t getOffsetOfFieldInBytes(CXCursor cursor) {
-    return clang_Cursor_getOffsetOfField(cursor) / 8;
-}
+int main(int argc, char** argv) {
+    Options options;
+    std::string servePath;
+    bool watchMode = false;
+    bool headerFromStdin = false;
+    bool stdinJson = false;
+    bool analyzeLayout = false;
+    bool jobsSet = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            options.jobs = std::max(1, std::atoi(argv[++i]));
+            jobsSet = true;
+        } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+            options.jobs = std::max(1, std::atoi(arg.c_str() + 2));
+            jobsSet = true;
+        } else if (arg == "--pch" && i + 1 < argc) {
+            options.pchPrefix = argv[++i];
+        } else if (arg == "--pch-out" && i + 1 < argc) {
+            options.pchOut = argv[++i];
+        } else if (arg == "--prune") {
+            options.prune = true;
+        } else if (arg == "--type-table") {
+            options.typeTable = true;
+        } else if (arg == "--typedefs") {
+            options.typedefRefs = true;
+        } else if (arg == "--macros") {
+            options.macros = true;
+        } else if (arg == "--file-table") {
+            options.fileTable = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--analyze-layout") {
+            analyzeLayout = true;
+        } else if (arg == "--abi") {
+            options.abi = true;
+        } else if (arg == "--exports" && i + 1 < argc) {
+            std::string error;
+            options.exports = ElfExports::load(argv[++i], error);
+            if (!options.exports) {
+                cerr << error << endl;
+                return -1;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            if (!parseOutputFormat(argv[++i], options.format)) {
+                cerr << "Unknown output format " << argv[i] << endl;
+                return -1;
+            }
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--compdb" && i + 1 < argc) {
+            options.compdbDir = argv[++i];
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            options.cacheDir = argv[++i];
+        } else if (arg == "--cache-max-size" && i + 1 < argc) {
+            options.cacheMaxBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--watch") {
+            watchMode = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (arg.rfind("-I", 0) == 0 || arg.rfind("-D", 0) == 0 || arg.rfind("--target=", 0) == 0) {
+            options.clangArgs.push_back(arg);
+        } else if (arg == "-") {
+            headerFromStdin = true;
+        } else if (arg == "--stdin-json") {
+            stdinJson = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if (arg.rfind("-", 0) == 0) {
+            usage(argv[0]);
+            return -1;
+        } else {
+            options.headers.push_back(arg);
+        }
+    }
 
-std::map<CXTypeKind, const char*> typeKindPrimitives = {
-    {CXType_Void, "void"},
-    {CXType_Bool, "bool"},
+    // The layout report and the ABI classification work on the merged output, which --stream, --watch and --serve
+    // never produce.
+    if ((analyzeLayout || options.abi) && (options.stream || watchMode || !servePath.empty())) {
+        cerr << "--analyze-layout and --abi do not support --stream, --watch or --serve" << endl;
+        return -1;
+    }
 
-    {CXType_Char_U, "unsigned char"},
-    {CXType_UChar, "unsigned char"},
-    {CXType_UShort, "unsigned short"},
-    {CXType_UInt, "unsigned int"},
-    {CXType_ULong, "unsigned long"},
-    {CXType_ULongLong, "unsigned long long"},
+    // The daemon keeps its units parsed in memory and answers each request with the whole output, so neither a PCH, the
+    // result cache nor streaming is involved.
+    if (!servePath.empty() && (!options.pchPrefix.empty() || !options.cacheDir.empty() || options.stream)) {
+        cerr << "--serve does not support --pch, --cache-dir or --stream" << endl;
+        return -1;
+    }
 
-    {CXType_Char_S, "signed char"},
-    {CXType_SChar, "signed char"},
-    {CXType_Short, "signed short"},
-    {CXType_Int, "signed int"},
-    {CXType_Long, "signed long"},
-    {CXType_LongLong, "unsigned long long"},
+    // Watched units stay parsed in memory and are re-extracted one at a time, so neither a PCH, the result cache nor
+    // worker threads are involved.
+    if (watchMode && (!options.pchPrefix.empty() || !options.cacheDir.empty() || jobsSet)) {
+        cerr << "--watch does not support --pch, --cache-dir or -j" << endl;
+        return -1;
+    }
 
-    {CXType_Float, "float"},
-    {CXType_Double, "double"},
-};
+    // The daemon takes its headers from requests; -I, -D and the extraction flags apply to all of them.
+    if (!servePath.empty()) {
+        return serve(options, servePath);
+    }
 
-json dumpType(CXType type) {
-    if (typeKindPrimitives.count(type.kind) != 0) {
-        return {
-            {"kind", "Primitive"},
-            {"name", typeKindPrimitives[type.kind]}
-        };
-    } else if (type.kind == CXType_Pointer) {
-        return {
-            {"kind", "Pointer"},
-            {"pointee", dumpType(clang_getPointeeType(type))},
-        };
-    } else if (type.kind == CXType_FunctionProto) {
-        json args = json::array();
-        int nArgs = clang_getNumArgTypes(type);
-        for (unsigned int i = 0; i < nArgs; i++) {
-            args.push_back(dumpType(clang_getArgType(type, i)));
+    // Headers read from stdin are handed to libclang as unsaved files, so they never touch the disk.
+    if (headerFromStdin || stdinJson) {
+        if (headerFromStdin && stdinJson) {
+            cerr << "- and --stdin-json both read stdin" << endl;
+            return -1;
         }
-
-        json out;
-        out["kind"] = "Function";
-        out["argTypes"] = args;
-        out["returnType"] = dumpType(clang_getResultType(type));
-
-        if (clang_isFunctionTypeVariadic(type)) {
-            out["varadic"] = true;
+        std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+        if (headerFromStdin) {
+            options.unsavedFiles.push_back({stdinHeaderPath, std::move(input)});
+        } else if (!parseUnsavedFiles(input, options.unsavedFiles)) {
+            cerr << "--stdin-json expects an array of {\"path\": ..., \"contents\": ...} objects" << endl;
+            return -1;
+        }
+        for (auto& file : options.unsavedFiles) {
+            options.headers.push_back(file.path);
         }
-
-        return out;
-    } else if (type.kind == CXType_Record) {
-        CXCursor cursor = clang_getTypeDeclaration(type);
-        CXType tpe = clang_getCursorType(cursor);
-        return {
-            {"kind", "Struct"},
-            {"name", getTypeSpelling(tpe)},
-        };
-    } else if (type.kind == CXType_Enum) {
-        return {
-            {"kind", "Enum"},
-            {"name", getTypeSpelling(type)},
-        };
-    } else if (type.kind == CXType_ConstantArray) {
-        return {
-            {"kind", "Array"},
-            {"elementType", dumpType(clang_getArrayElementType(type))},
-            {"size", clang_getArraySize(type)},
-        };
-    } else {
-        return {{"kind", "Unknown"}, {"id", (unsigned  int)type.kind}, {"name", ClangString(clang_getTypeKindSpelling(type.kind)).str()}};
     }
-}
 
-CXChildVisitResult fieldVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data) {
-    auto cursorKind = clang_getCursorKind(cursor);
-    if (cursorKind == CXCursor_FieldDecl) {
-        auto& fields = *reinterpret_cast<json*>(client_data);
-        auto type = clang_getCursorType(cursor);
-        auto canType = clang_getCanonicalType(type);
-        auto size = clang_Type_getSizeOf(type);
-        auto offset = getOffsetOfFieldInBytes(cursor);
-        auto name = ClangString(clang_getCursorSpelling(cursor)).str();
-        auto tpe = dumpType(canType);
-        fields.push_back({
-            {"size", size},
-            {"offset", offset},
-            {"name", name},
-            {"type", tpe},
-        });
+    if (options.headers.empty() && options.compdbDir.empty()) {
+        options.headers.emplace_back("test.h");
     }
 
-    return CXChildVisit_Continue;
-}
-
-CXChildVisitResult typeVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data) {
-    auto kind = clang_getCursorKind(cursor);
+    if (!options.pchPrefix.empty() && options.pchOut.empty()) {
+        options.pchOut = options.pchPrefix + ".pch";
+    }
 
-    CXFile file;
-    unsigned int line;
-    unsigned int col;
-    unsigned int offset;
-    clang_getFileLocation(clang_getCursorLocation(cursor), &file, &line, &col, &offset);
-    auto fileName = ClangString(clang_getFileName(file)).str();
+    if (options.stream && !isStreamableFormat(options.format)) {
+        cerr << "--stream only supports the json and cbor formats" << endl;
+        return -1;
+    }
 
-    if ((kind == CXCursor_ClassDecl || kind == CXCursor_StructDecl) && !isAnonymousType(cursor) && !isForwardDecl(cursor)) {
-        auto type = clang_getCursorType(cursor);
-        auto size = clang_Type_getSizeOf(type);
-        auto name = getTypeSpelling(type);
-        auto& info = (*reinterpret_cast<json*>(client_data));
-        info["structs"][name]["size"] = size;
-        info["structs"][name]["fields"] = json::array();
-        clang_visitChildren(cursor, fieldVisitor, reinterpret_cast<CXClientData>(&info["structs"][name]["fields"]));
-        info["srcRefs"][name]["fileName"] = fileName;
-        info["srcRefs"][name]["line"] = line;
-        info["srcRefs"][name]["col"] = col;
-        info["srcRefs"][name]["offset"] = offset;
-    } else if (kind == CXCursor_FunctionDecl) {
-        auto type = clang_getCursorType(cursor);
-        auto canType = clang_getCanonicalType(type);
-        auto name = getCursorSpelling(cursor);
-        json& info = (*reinterpret_cast<json*>(client_data));
-        info["vars"][name] = dumpType(canType);
-        info["vars"][name].erase("kind");
+    // Cache keys hash the header contents on disk, which in-memory headers do not have.
+    if (!options.unsavedFiles.empty() && !options.cacheDir.empty()) {
+        cerr << "In-memory headers disable --cache-dir" << endl;
+        options.cacheDir.clear();
+    }
 
-        info["srcRefs"][name]["fileName"] = fileName;
-        info["srcRefs"][name]["line"] = line;
-        info["srcRefs"][name]["col"] = col;
-        info["srcRefs"][name]["offset"] = offset;
-    } else if (kind == CXCursor_EnumConstantDecl) {
-        auto name = getCursorSpelling(cursor);
-        auto type = clang_getCanonicalType(clang_getCursorType(cursor));
-        json& info = (*reinterpret_cast<json *>(client_data));
-        info["constants"][name]["type"] = dumpType(type);
-        info["constants"][name]["value"] = clang_getEnumConstantDeclValue(cursor);
+    // Streamed output is never materialized, so there is nothing to store in the cache.
+    if (options.stream && !options.cacheDir.empty()) {
+        cerr << "--stream disables --cache-dir" << endl;
+        options.cacheDir.clear();
+    }
 
-        info["srcRefs"][name]["fileName"] = fileName;
-        info["srcRefs"][name]["line"] = line;
-        info["srcRefs"][name]["col"] = col;
-        info["srcRefs"][name]["offset"] = offset;
-    } else if (kind == CXCursor_VarDecl) {
-        auto type = clang_getCursorType(cursor);
-        auto canType = clang_getCanonicalType(type);
-        auto name = getCursorSpelling(cursor);
-        auto eval = clang_Cursor_Evaluate(cursor);
-        auto ekind = clang_EvalResult_getKind(eval);
-        json outValue;
-        bool success = true;
-        if (ekind == CXEval_Int) {
-            outValue = clang_EvalResult_getAsInt(eval);
-        } else if (ekind == CXEval_Float) {
-            outValue = clang_EvalResult_getAsDouble(eval);
-        } else if (ekind == CXEval_StrLiteral) {
-            outValue = clang_EvalResult_getAsStr(eval);
-        } else success = false;
-        clang_EvalResult_dispose(eval);
+    std::string outPath = std::string("clang-c.") + outputExtension(options.format);
+    if (watchMode) {
+        if (options.stream || !options.compdbDir.empty() || !options.unsavedFiles.empty()) {
+            cerr << "--watch does not support --stream, --compdb or in-memory headers" << endl;
+            return -1;
+        }
+        return watch(options, outPath);
+    }
 
-        json& info = (*reinterpret_cast<json *>(client_data));
-        if (success) {
-            info["constants"][name]["type"] = dumpType(canType);
-            info["constants"][name]["value"] = outValue;
+    std::unique_ptr<ResultCache> cache;
+    if (!options.cacheDir.empty()) {
+        cache = std::make_unique<ResultCache>(options.cacheDir, options.cacheMaxBytes, outputConfig(options));
+    }
 
-            info["srcRefs"][name]["fileName"] = fileName;
-            info["srcRefs"][name]["line"] = line;
-            info["srcRefs"][name]["col"] = col;
-            info["srcRefs"][name]["offset"] = offset;
-        }
+    // Output goes to a temporary file that replaces clang-c.json only once everything was written.
+    auto outTmpPath = outPath + ".tmp." + std::to_string(getpid());
+    int outFd = open(outTmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) {
+        cerr << "Unable to open " << outTmpPath << endl;
+        exit(-1);
     }
 
-    return CXChildVisit_Recurse;
-}
+    Stats stats;
+    StatsScope statsScope(options.stats ? &stats : nullptr);
+
+    // The layout report takes stdout's place; the declarations still go to the output file.
+    std::vector<int> outFds = {outFd};
+    if (!analyzeLayout) outFds.push_back(STDOUT_FILENO);
+    OutputSink sink(outFds);
+    TypeTable types;
+    FileTable files;
+    std::unique_ptr<StreamWriter> stream;
+    if (options.stream) {
+        stream = std::make_unique<StreamWriter>(sink, options.format);
+    }
 
-int main() {
-    CXIndex index = clang_createIndex(0, 0);
+    auto results = extractHeaders(options, cache.get(), stream.get(), &types, &files);
 
-    CXTranslationUnit unit;
-    auto err = clang_parseTranslationUnit2(
-        index,
-        "test.h", (const char * const[]){"-I/usr/lib/llvm-6.0/lib/clang/6.0.0/include/", "-I/usr/lib/llvm-6.0/include/"}, 2,
-        nullptr, 0,
-        CXTranslationUnit_None,
-        &unit
-    );
+    if (cache) {
+        cache->evict();
+    }
 
-    if (err != CXError_Success) {
-        if (unit == nullptr) {
-            cerr << "Unit null" << endl;
+    json out;
+    bool failed = false;
+    for (auto& result : results) {
+        stats.merge(result.stats);
+        cerr << result.diagnostics;
+        if (!result.ok) {
+            failed = true;
+            continue;
+        }
+        if (!stream) {
+            mergeTypes(types, result.info);
+            mergeFiles(files, result.info);
+            mergeInfo(out, result.info);
         }
+    }
 
-        cerr << "Unable to parse translation unit: " << err << endl;
+    if (failed) {
+        close(outFd);
+        unlink(outTmpPath.c_str());
         exit(-1);
     }
 
-    for (unsigned I = 0, N = clang_getNumDiagnostics(unit); I != N; ++I) {
-        CXDiagnostic diag = clang_getDiagnostic(unit, I);
-        CXString str = clang_formatDiagnostic(diag, clang_defaultDiagnosticDisplayOptions());
-        fprintf(stderr, "%s\n", clang_getCString(str));
-        clang_disposeString(str);
+    if (stream) {
+        if (options.typeTable) {
+            stream->emitSection("types", types.entries);
+        }
+        if (options.fileTable) {
+            stream->emitSection("files", files.entries);
+        }
+        stream->finish();
+    } else {
+        if (options.typeTable) {
+            out["types"] = std::move(types.entries);
+        }
+        if (options.fileTable) {
+            out["files"] = std::move(files.entries);
+        }
+        if (!options.compdbDir.empty()) {
+            canonicalizeOutput(out);
+        }
+        if (options.abi) {
+            std::string triple;
+            size_t unclassified;
+            if (!abiTarget(out, triple)) {
+                cerr << "--abi needs every unit parsed for the same target" << endl;
+            } else if (!classifyCalls(out, triple, unclassified)) {
+                cerr << "--abi does not support target " << triple << endl;
+            } else if (unclassified > 0) {
+                cerr << unclassified << " functions left unclassified by --abi" << endl;
+            }
+        }
+        if (analyzeLayout) {
+            printLayoutReport(std::cout, out);
+        }
+        writeValue(sink, out, options.format);
     }
 
-    CXCursor rootCursor = clang_getTranslationUnitCursor(unit);
-
-    json out;
-    clang_visitChildren(rootCursor, typeVisitor, reinterpret_cast<CXClientData>(&out));
-
-    std::ofstream outfile;
-    outfile.open("clang-c.json");
-    outfile << out.dump(2) << endl;
-    outfile.close();
-
-    cout << out.dump(2) << endl;
+    if (options.format == OutputFormat::Json) {
+        sink.put('\n');
+    }
+    sink.flush();
+    int writeError = stream ? stream->error() : sink.error();
+    if (close(outFd) != 0 && writeError == 0) writeError = errno;
+    if (writeError == 0 && rename(outTmpPath.c_str(), outPath.c_str()) != 0) writeError = errno;
+    if (writeError != 0) {
+        cerr << "Unable to write " << outPath << ": " << strerror(writeError) << endl;
+        unlink(outTmpPath.c_str());
+        exit(-1);
+    }
 
-    clang_disposeTranslationUnit(unit);
-    clang_disposeIndex(index);
+    if (options.stats) {
+        cerr << stats.toJson().dump(2) << endl;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
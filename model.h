@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+#ifdef NATIVEBINDGEN_STD_JSON
+using json = nlohmann::json;
+#else
+#include "arena.h"
+#include "flat_map.h"
+
+// Objects are insertion-ordered flat hash maps and nodes come from a per-thread arena, instead of a std::map with a
+// heap node per key. Set NATIVEBINDGEN_STD_JSON to fall back to nlohmann::json.
+using json = nlohmann::basic_json<FlatMap, std::vector, std::string, bool, std::int64_t, std::uint64_t, double, ArenaAllocator>;
+#endif
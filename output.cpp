@@ -0,0 +1,275 @@
+#include "output.h"
+#include "stats.h"
+
+#include <cerrno>
+#include <unistd.h>
+
+static constexpr size_t sinkBufferSize = 1 << 16;
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    if (name == "json") {
+        format = OutputFormat::Json;
+    } else if (name == "cbor") {
+        format = OutputFormat::Cbor;
+    } else if (name == "msgpack") {
+        format = OutputFormat::MsgPack;
+    } else if (name == "ubjson") {
+        format = OutputFormat::UBJson;
+    } else if (name == "bson") {
+        format = OutputFormat::Bson;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* outputExtension(OutputFormat format) {
+    switch (format) {
+        case OutputFormat::Json: return "json";
+        case OutputFormat::Cbor: return "cbor";
+        case OutputFormat::MsgPack: return "msgpack";
+        case OutputFormat::UBJson: return "ubjson";
+        case OutputFormat::Bson: return "bson";
+    }
+    return "json";
+}
+
+bool isStreamableFormat(OutputFormat format) {
+    return format == OutputFormat::Json || format == OutputFormat::Cbor;
+}
+
+OutputSink::OutputSink(std::vector<int> fds) : _fds(std::move(fds)) {
+    _buffer.reserve(sinkBufferSize);
+}
+
+OutputSink::OutputSink(std::string& target) : _target(&target) {
+    _buffer.reserve(sinkBufferSize);
+}
+
+OutputSink::~OutputSink() {
+    flush();
+}
+
+void OutputSink::write(const char* data, size_t size) {
+    if (_buffer.size() + size > sinkBufferSize) {
+        flush();
+        if (size > sinkBufferSize) {
+            _buffer.insert(_buffer.end(), data, data + size);
+            flush();
+            return;
+        }
+    }
+    _buffer.insert(_buffer.end(), data, data + size);
+}
+
+void OutputSink::put(char c) {
+    if (_buffer.size() == sinkBufferSize) flush();
+    _buffer.push_back(c);
+}
+
+void OutputSink::flush() {
+    if (_buffer.empty()) return;
+
+    PhaseTimer timer(Phase::Write);
+    if (_target && _error == 0) {
+        _target->append(_buffer.data(), _buffer.size());
+    }
+    for (int fd : _fds) {
+        size_t written = 0;
+        while (_error == 0 && written < _buffer.size()) {
+            auto n = ::write(fd, _buffer.data() + written, _buffer.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                _error = n < 0 ? errno : ENOSPC;
+                break;
+            }
+            written += n;
+        }
+    }
+    _buffer.clear();
+}
+
+void OutputSink::fail(int error) {
+    if (_error == 0) _error = error;
+    _buffer.clear();
+}
+
+namespace {
+
+// CBOR indefinite-length map markers.
+constexpr char cborMapStart = (char)0xbf;
+constexpr char cborBreak = (char)0xff;
+constexpr char cborNull = (char)0xf6;
+
+class SinkAdapter : public nlohmann::detail::output_adapter_protocol<char> {
+public:
+    explicit SinkAdapter(OutputSink& sink) : _sink(sink) {}
+
+    void write_character(char c) override {
+        _sink.put(c);
+    }
+
+    void write_characters(const char* s, std::size_t length) override {
+        _sink.write(s, length);
+    }
+
+private:
+    OutputSink& _sink;
+};
+
+}
+
+void writeJson(OutputSink& sink, const json& value, unsigned indent, unsigned currentIndent) {
+    PhaseTimer timer(Phase::Serialize);
+    nlohmann::detail::serializer<json> serializer(std::make_shared<SinkAdapter>(sink), ' ');
+    try {
+        serializer.dump(value, true, false, indent, currentIndent);
+    } catch (const json::exception&) {
+        // Strings are dumped as they are, and only invalid UTF-8 throws.
+        sink.fail(EILSEQ);
+    }
+}
+
+void writeValue(OutputSink& sink, const json& value, OutputFormat format) {
+    if (format == OutputFormat::Json) {
+        writeJson(sink, value);
+        return;
+    }
+
+    PhaseTimer timer(Phase::Serialize);
+    nlohmann::detail::binary_writer<json, char> writer(std::make_shared<SinkAdapter>(sink));
+    try {
+        switch (format) {
+            case OutputFormat::Json:
+                break;
+            case OutputFormat::Cbor:
+                writer.write_cbor(value);
+                break;
+            case OutputFormat::MsgPack:
+                writer.write_msgpack(value);
+                break;
+            case OutputFormat::UBJson:
+                writer.write_ubjson(value, true, true);
+                break;
+            case OutputFormat::Bson:
+                // BSON documents must be objects, an empty extraction is written as an empty document.
+                writer.write_bson(value.is_null() ? json::object() : value);
+                break;
+        }
+    } catch (const json::exception&) {
+        // UBJSON and BSON have no integer type above INT64_MAX, which unsigned long long constants can reach.
+        sink.fail(EOVERFLOW);
+    }
+}
+
+StreamWriter::StreamWriter(OutputSink& sink, OutputFormat format) : _sink(sink), _format(format) {}
+
+StreamWriter::~StreamWriter() {
+    for (auto& section : _sections) {
+        section.second.sink.reset();
+        if (section.second.file) fclose(section.second.file);
+    }
+}
+
+StreamWriter::Section& StreamWriter::section(const std::string& name) {
+    auto& section = _sections[name];
+    if (section.sink == nullptr) {
+        section.file = tmpfile();
+        if (section.file == nullptr && _error == 0) _error = errno;
+        // Without a spool the section is dropped, and error() makes sure the output is not used.
+        std::vector<int> fds;
+        if (section.file) fds.push_back(fileno(section.file));
+        section.sink = std::make_unique<OutputSink>(fds);
+    }
+    return section;
+}
+
+bool StreamWriter::contains(const std::string& section, const std::string& key) const {
+    auto it = _sections.find(section);
+    return it != _sections.end() && it->second.keys.count(key) != 0;
+}
+
+void StreamWriter::emit(const std::string& name, const std::string& key, const json& value) {
+    auto& section = this->section(name);
+    if (!section.keys.insert(key).second) return;
+
+    auto& sink = *section.sink;
+    if (_format == OutputFormat::Cbor) {
+        writeValue(sink, key, _format);
+        writeValue(sink, value, _format);
+        return;
+    }
+
+    if (section.keys.size() > 1) sink.write(",\n", 2);
+    sink.write("    ", 4);
+    writeJson(sink, key, 0);
+    sink.write(": ", 2);
+    writeJson(sink, value, 2, 4);
+}
+
+void StreamWriter::emitSection(const std::string& name, const json& value) {
+    auto& section = this->section(name);
+    section.whole = true;
+    if (_format == OutputFormat::Cbor) {
+        writeValue(*section.sink, value, _format);
+    } else {
+        writeJson(*section.sink, value, 2, 2);
+    }
+}
+
+void StreamWriter::finish() {
+    bool cbor = _format == OutputFormat::Cbor;
+    bool first = true;
+    for (auto& entry : _sections) {
+        auto& section = entry.second;
+        if (!section.whole && section.keys.empty()) continue;
+
+        if (cbor) {
+            if (first) _sink.put(cborMapStart);
+            writeValue(_sink, entry.first, _format);
+            if (!section.whole) _sink.put(cborMapStart);
+        } else {
+            _sink.write(first ? "{\n  " : ",\n  ", 4);
+            writeJson(_sink, entry.first, 0);
+            _sink.write(section.whole ? ": " : ": {\n", section.whole ? 2 : 4);
+        }
+        first = false;
+
+        section.sink->flush();
+        if (_error == 0) _error = section.sink->error();
+        if (section.file) {
+            rewind(section.file);
+            char buffer[1 << 14];
+            for (size_t n; (n = fread(buffer, 1, sizeof(buffer), section.file)) > 0;) {
+                _sink.write(buffer, n);
+            }
+            if (ferror(section.file) && _error == 0) _error = EIO;
+        }
+
+        if (!section.whole) {
+            if (cbor) {
+                _sink.put(cborBreak);
+            } else {
+                _sink.write("\n  }", 4);
+            }
+        }
+    }
+
+    // An empty document is a null json value, which is what dump() prints for it too.
+    if (first) {
+        if (cbor) {
+            _sink.put(cborNull);
+        } else {
+            _sink.write("null", 4);
+        }
+    } else if (cbor) {
+        _sink.put(cborBreak);
+    } else {
+        _sink.write("\n}", 2);
+    }
+    _sink.flush();
+}
+
+int StreamWriter::error() const {
+    return _error ? _error : _sink.error();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "model.h"
+
+enum class OutputFormat {
+    Json,
+    Cbor,
+    MsgPack,
+    UBJson,
+    Bson,
+};
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format);
+
+// File extension for clang-c.<ext> output.
+const char* outputExtension(OutputFormat format);
+
+// Whether StreamWriter can produce the format incrementally. MessagePack, UBJSON and BSON prefix every object with its
+// size or entry count, which is not known until the whole section was visited.
+bool isStreamableFormat(OutputFormat format);
+
+// Buffered writer that fans the same bytes out to several file descriptors, so output going to both a file and
+// stdout is only produced once.
+class OutputSink {
+public:
+    explicit OutputSink(std::vector<int> fds);
+    // Collects the output in memory instead, appending it to target on every flush.
+    explicit OutputSink(std::string& target);
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(const char* data, size_t size);
+    void put(char c);
+    void flush();
+
+    // The errno of the first write that failed, or 0. Once a write fails, everything after it is dropped.
+    int error() const {
+        return _error;
+    }
+
+    // Fails the sink as a failed write would, for output that could not be encoded.
+    void fail(int error);
+
+private:
+    std::vector<int> _fds;
+    std::string* _target = nullptr;
+    std::vector<char> _buffer;
+    int _error = 0;
+};
+
+// Serializes a json value straight into the sink. Matches value.dump(indent) when currentIndent is zero. Values the
+// format cannot represent, like invalid UTF-8 in json or unsigned integers above INT64_MAX in UBJSON and BSON, fail the
+// sink with EOVERFLOW or EILSEQ.
+void writeJson(OutputSink& sink, const json& value, unsigned indent = 2, unsigned currentIndent = 0);
+
+// Serializes a json value in the given format straight into the sink, without materializing the encoding first.
+void writeValue(OutputSink& sink, const json& value, OutputFormat format);
+
+// Writes the top-level output object incrementally, one entry at a time, with the same layout dump(2) produces (or
+// as CBOR indefinite-length maps). Sections can be filled in any interleaving: each one is spooled to an unlinked
+// temporary file and the spools are copied out in key order by finish(), so the entries themselves are never held in
+// memory. The keys written to each section are kept to drop duplicates, and the type, symbol and file tables the
+// extractor shares across units still grow with the headers parsed.
+class StreamWriter {
+public:
+    explicit StreamWriter(OutputSink& sink, OutputFormat format = OutputFormat::Json);
+    ~StreamWriter();
+
+    bool contains(const std::string& section, const std::string& key) const;
+
+    // Adds section[key] = value. Keys already written to a section are ignored.
+    void emit(const std::string& section, const std::string& key, const json& value);
+
+    // Sets a whole top-level value, for sections that are not keyed objects.
+    void emitSection(const std::string& section, const json& value);
+
+    void finish();
+
+    // The errno of the first failure to spool or copy out a section, or of the output sink, or 0.
+    int error() const;
+
+private:
+    struct Section {
+        FILE* file = nullptr;
+        std::unique_ptr<OutputSink> sink;
+        std::unordered_set<std::string> keys;
+        bool whole = false;
+    };
+
+    Section& section(const std::string& name);
+
+    OutputSink& _sink;
+    OutputFormat _format;
+    std::map<std::string, Section> _sections;
+    int _error = 0;
+};
@@ -0,0 +1,321 @@
+#include "server.h"
+#include "output.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+
+namespace {
+
+constexpr size_t maxRequestBytes = 1 << 20;
+
+// How long a client gets to send its whole request, and to take each chunk of the response. Requests are served one at
+// a time, so a client that stalls holds up every other one until then.
+constexpr int clientTimeoutMillis = 5000;
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+struct Dependency {
+    std::string path;
+    timespec mtime;
+};
+
+timespec fileMTime(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return {0, 0};
+    return st.st_mtim;
+}
+
+// A parsed header kept in memory between requests, along with its output in every format asked for so far.
+struct WarmUnit {
+    CXTranslationUnit unit = nullptr;
+    std::vector<std::string> args;
+    std::vector<Dependency> deps;
+    json out;
+    std::map<OutputFormat, std::string> encoded;
+    uint64_t lastUsed = 0;
+};
+
+// Warm units kept at once; the least recently used one is disposed of to make room for another.
+constexpr size_t maxWarmUnits = 16;
+
+class Server {
+public:
+    explicit Server(const Options& options) : _options(options), _index(clang_createIndex(0, 0)) {}
+
+    ~Server() {
+        for (auto& entry : _units) {
+            clang_disposeTranslationUnit(entry.second.unit);
+        }
+        clang_disposeIndex(_index);
+    }
+
+    std::string handle(const std::string& request);
+
+private:
+    WarmUnit* unit(const std::string& header, const std::vector<std::string>& args, std::string& error);
+    void extract(WarmUnit& warm);
+    bool stale(const WarmUnit& warm) const;
+
+    const Options& _options;
+    CXIndex _index;
+    std::map<std::string, WarmUnit> _units;
+    uint64_t _requests = 0;
+};
+
+std::string errorResponse(const std::string& message) {
+    json response;
+    response["error"] = message;
+    return response.dump() + "\n";
+}
+
+std::string Server::handle(const std::string& request) {
+    auto parsed = json::parse(request, nullptr, false);
+    if (parsed.is_discarded() || !parsed.is_object()) {
+        return errorResponse("Malformed request");
+    }
+
+    auto header = parsed.find("header");
+    if (header == parsed.end() || !header->is_string()) {
+        return errorResponse("Missing header");
+    }
+    // A relative path would resolve against the daemon's working directory, not the client's.
+    if (header->get<std::string>().rfind('/', 0) != 0) {
+        return errorResponse("Header path must be absolute");
+    }
+
+    std::vector<std::string> args;
+    auto argsIt = parsed.find("args");
+    if (argsIt != parsed.end()) {
+        if (!argsIt->is_array()) return errorResponse("Arguments must be an array");
+        for (auto& arg : *argsIt) {
+            if (!arg.is_string()) return errorResponse("Arguments must be strings");
+            args.push_back(arg.get<std::string>());
+        }
+    }
+
+    auto format = _options.format;
+    auto formatIt = parsed.find("format");
+    if (formatIt != parsed.end() && (!formatIt->is_string() || !parseOutputFormat(formatIt->get<std::string>(), format))) {
+        return errorResponse("Unknown output format");
+    }
+
+    std::string error;
+    auto warm = unit(header->get<std::string>(), args, error);
+    if (!warm) {
+        return errorResponse(error);
+    }
+
+    auto encoded = warm->encoded.find(format);
+    if (encoded == warm->encoded.end()) {
+        std::string bytes;
+        {
+            OutputSink sink(bytes);
+            writeValue(sink, warm->out, format);
+            if (format == OutputFormat::Json) {
+                sink.put('\n');
+            }
+            if (sink.error() != 0) {
+                return errorResponse(std::string("Unable to encode output: ") + strerror(sink.error()));
+            }
+        }
+        encoded = warm->encoded.emplace(format, std::move(bytes)).first;
+    }
+    return encoded->second;
+}
+
+WarmUnit* Server::unit(const std::string& header, const std::vector<std::string>& args, std::string& error) {
+    auto key = header;
+    for (auto& arg : args) {
+        key += '\0';
+        key += arg;
+    }
+
+    auto it = _units.find(key);
+    if (it != _units.end()) {
+        auto& warm = it->second;
+        warm.lastUsed = ++_requests;
+        if (!stale(warm)) return &warm;
+
+        int err;
+        {
+            PhaseTimer timer(Phase::Parse);
+            err = clang_reparseTranslationUnit(warm.unit, 0, nullptr, clang_defaultReparseOptions(warm.unit));
+        }
+        if (err == 0) {
+            extract(warm);
+            return &warm;
+        }
+        // A failed reparse leaves the unit unusable; start over from a fresh parse.
+        clang_disposeTranslationUnit(warm.unit);
+        _units.erase(it);
+    }
+
+    auto allArgs = _options.clangArgs;
+    allArgs.insert(allArgs.end(), args.begin(), args.end());
+    auto unit = parseWarmUnit(_index, header, allArgs, _options, error);
+    if (!unit) return nullptr;
+
+    if (_units.size() >= maxWarmUnits) {
+        auto oldest = std::min_element(_units.begin(), _units.end(), [](const auto& a, const auto& b) {
+            return a.second.lastUsed < b.second.lastUsed;
+        });
+        clang_disposeTranslationUnit(oldest->second.unit);
+        _units.erase(oldest);
+    }
+
+    auto& warm = _units[key];
+    warm.lastUsed = ++_requests;
+    warm.unit = unit;
+    warm.args = std::move(allArgs);
+    extract(warm);
+    return &warm;
+}
+
+void Server::extract(WarmUnit& warm) {
+    auto result = extractUnit(warm.unit, _options, warm.args);
+    cerr << result.diagnostics;
+    if (_options.stats) {
+        cerr << result.stats.toJson().dump(2) << endl;
+    }
+
+    TypeTable types;
+    FileTable files;
+    warm.out = json();
+    mergeTypes(types, result.info);
+    mergeFiles(files, result.info);
+    mergeInfo(warm.out, result.info);
+    if (_options.typeTable) {
+        warm.out["types"] = std::move(types.entries);
+    }
+    if (_options.fileTable) {
+        warm.out["files"] = std::move(files.entries);
+    }
+    warm.encoded.clear();
+
+    warm.deps.clear();
+    for (auto& path : unitInclusions(warm.unit)) {
+        warm.deps.push_back({path, fileMTime(path)});
+    }
+}
+
+bool Server::stale(const WarmUnit& warm) const {
+    for (auto& dep : warm.deps) {
+        auto mtime = fileMTime(dep.path);
+        if (mtime.tv_sec != dep.mtime.tv_sec || mtime.tv_nsec != dep.mtime.tv_nsec) return true;
+    }
+    return false;
+}
+
+// Reads one request line. Gives up when the client has not sent it within clientTimeoutMillis.
+bool readRequest(int fd, std::string& request) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(clientTimeoutMillis);
+    char buffer[4096];
+    while (request.size() < maxRequestBytes) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()
+        ).count();
+        if (remaining <= 0) return false;
+
+        pollfd pollFd{fd, POLLIN, 0};
+        auto ready = poll(&pollFd, 1, (int)remaining);
+        if (ready < 0 && errno == EINTR && !stopRequested) continue;
+        if (ready <= 0) return false;
+
+        auto n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR && !stopRequested) continue;
+        if (n <= 0) return !request.empty();
+        auto newline = static_cast<const char*>(memchr(buffer, '\n', n));
+        if (newline) {
+            request.append(buffer, newline - buffer);
+            return true;
+        }
+        request.append(buffer, n);
+    }
+    return false;
+}
+
+void writeResponse(int fd, const std::string& response) {
+    size_t written = 0;
+    while (written < response.size()) {
+        auto n = write(fd, response.data() + written, response.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+}
+
+}
+
+int serve(const Options& options, const std::string& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path too long: " << socketPath << endl;
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        cerr << "Unable to create socket: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    // A socket file left behind by a previous daemon that did not shut down cleanly would make bind fail.
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+        cerr << "Unable to listen on " << socketPath << ": " << strerror(errno) << endl;
+        close(listenFd);
+        return -1;
+    }
+
+    // No SA_RESTART, so a signal interrupts accept and the loop gets to check stopRequested.
+    struct sigaction action{};
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server(options);
+    while (!stopRequested) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            cerr << "accept failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        // Writes to a client that stopped reading time out instead of blocking the daemon.
+        timeval sendTimeout{clientTimeoutMillis / 1000, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+        std::string request;
+        if (readRequest(fd, request)) {
+            writeResponse(fd, server.handle(request));
+        }
+        close(fd);
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include "bindgen.h"
+
+// Answers extraction requests on a Unix domain socket, keeping parsed translation units warm between requests.
+//
+// A request is one line of JSON: {"header": "<absolute path>", "args": ["-I..."], "format": "json"}. The response is
+// the same output a single-header run would write to clang-c.<ext>, or {"error": "..."} as JSON, and the connection is
+// closed. Paths in args resolve against the daemon's working directory. Requests are served one at a time, and a client
+// that does not send its request or read its response in time is dropped.
+// Units are reparsed with clang_reparseTranslationUnit once any file they include changed on disk; until then the
+// encoded output is served from memory. Returns once SIGINT or SIGTERM arrives.
+int serve(const Options& options, const std::string& socketPath);
@@ -0,0 +1,125 @@
+#include "stats.h"
+
+#include <ctime>
+#include <sys/resource.h>
+
+thread_local Stats* Stats::currentStats = nullptr;
+
+static thread_local PhaseTimer* currentTimer = nullptr;
+
+static const char* phaseNames[phaseCount] = {
+    "parse",
+    "visit",
+    "fields",
+    "dumpType",
+    "evaluate",
+    "serialize",
+    "write",
+};
+
+const char* phaseName(Phase phase) {
+    return phaseNames[(size_t)phase];
+}
+
+static double threadCpuMs() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+PhaseTimer::PhaseTimer(Phase phase) : _stats(Stats::current()), _phase(phase) {
+    if (!_stats) return;
+    _parent = currentTimer;
+    currentTimer = this;
+    _wallStart = std::chrono::steady_clock::now();
+    _cpuStart = threadCpuMs();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!_stats) return;
+
+    auto wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _wallStart).count();
+    auto cpuMs = threadCpuMs() - _cpuStart;
+
+    auto& time = _stats->phases[(size_t)_phase];
+    time.wallMs += wallMs - _childWallMs;
+    time.cpuMs += cpuMs - _childCpuMs;
+
+    currentTimer = _parent;
+    if (_parent) {
+        _parent->_childWallMs += wallMs;
+        _parent->_childCpuMs += cpuMs;
+    }
+}
+
+void Stats::addResourceUsage(CXTranslationUnit unit) {
+    auto usage = clang_getCXTUResourceUsage(unit);
+    for (unsigned i = 0; i < usage.numEntries; i++) {
+        auto& entry = usage.entries[i];
+        resourceUsage[clang_getTUResourceUsageName(entry.kind)] += entry.amount;
+    }
+    clang_disposeCXTUResourceUsage(usage);
+}
+
+void Stats::merge(const Stats& other) {
+    for (size_t i = 0; i < phaseCount; i++) {
+        phases[i].wallMs += other.phases[i].wallMs;
+        phases[i].cpuMs += other.phases[i].cpuMs;
+    }
+
+    if (other.cursorKinds.size() > cursorKinds.size()) cursorKinds.resize(other.cursorKinds.size());
+    for (size_t i = 0; i < other.cursorKinds.size(); i++) {
+        cursorKinds[i] += other.cursorKinds[i];
+    }
+
+    dumpTypeCalls += other.dumpTypeCalls;
+    maxDumpTypeDepth = std::max(maxDumpTypeDepth, other.maxDumpTypeDepth);
+    headers += other.headers;
+    cacheHits += other.cacheHits;
+
+    for (auto& entry : other.resourceUsage) {
+        resourceUsage[entry.first] += entry.second;
+    }
+}
+
+json Stats::toJson() const {
+    json out;
+
+    // Worker phases are summed over threads, so wall time can exceed the elapsed time of a parallel run.
+    for (size_t i = 0; i < phaseCount; i++) {
+        out["phases"][phaseNames[i]] = {
+            {"wallMs", phases[i].wallMs},
+            {"cpuMs", phases[i].cpuMs},
+        };
+    }
+
+    uint64_t totalCursors = 0;
+    out["cursors"] = json::object();
+    for (size_t kind = 0; kind < cursorKinds.size(); kind++) {
+        if (cursorKinds[kind] == 0) continue;
+        CXString name = clang_getCursorKindSpelling((CXCursorKind)kind);
+        out["cursors"][clang_getCString(name)] = cursorKinds[kind];
+        clang_disposeString(name);
+        totalCursors += cursorKinds[kind];
+    }
+    out["totalCursors"] = totalCursors;
+
+    out["dumpType"] = {
+        {"calls", dumpTypeCalls},
+        {"maxDepth", maxDumpTypeDepth},
+    };
+
+    out["headers"] = headers;
+    out["cacheHits"] = cacheHits;
+
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    out["peakRssKiB"] = usage.ru_maxrss;
+
+    out["libclang"] = json::object();
+    for (auto& entry : resourceUsage) {
+        out["libclang"][entry.first] = entry.second;
+    }
+
+    return out;
+}
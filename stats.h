@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <clang-c/Index.h>
+#include "model.h"
+
+enum class Phase {
+    Parse,
+    Visit,
+    Fields,
+    DumpType,
+    Evaluate,
+    Serialize,
+    Write,
+};
+
+constexpr size_t phaseCount = 7;
+
+const char* phaseName(Phase phase);
+
+// Counters collected by --stats. Each worker thread fills its own instance through Stats::current(), and the
+// instances are merged once extraction is done.
+struct Stats {
+    struct Time {
+        double wallMs = 0;
+        double cpuMs = 0;
+    };
+
+    Time phases[phaseCount];
+    std::vector<uint64_t> cursorKinds;
+    uint64_t dumpTypeCalls = 0;
+    unsigned dumpTypeDepth = 0;
+    unsigned maxDumpTypeDepth = 0;
+    uint64_t headers = 0;
+    uint64_t cacheHits = 0;
+    std::map<std::string, uint64_t> resourceUsage;
+
+    // The instance collecting for the calling thread, or null when --stats is off.
+    static Stats* current() {
+        return currentStats;
+    }
+
+    void countCursor(CXCursorKind kind) {
+        if ((size_t)kind >= cursorKinds.size()) cursorKinds.resize((size_t)kind + 1);
+        cursorKinds[kind]++;
+    }
+
+    // Adds the resource usage libclang reports for a translation unit.
+    void addResourceUsage(CXTranslationUnit unit);
+
+    void merge(const Stats& other);
+
+    // Includes the process wide peak RSS, so call it once everything is done.
+    json toJson() const;
+
+private:
+    friend class StatsScope;
+    static thread_local Stats* currentStats;
+};
+
+// Makes stats the current instance for the calling thread while in scope.
+class StatsScope {
+public:
+    explicit StatsScope(Stats* stats) : _previous(Stats::currentStats) {
+        Stats::currentStats = stats;
+    }
+
+    ~StatsScope() {
+        Stats::currentStats = _previous;
+    }
+
+private:
+    Stats* _previous;
+};
+
+// Times a phase into the current Stats. Times are exclusive: a timer started inside another one pauses its parent, so
+// visit time does not include the fields, types and evaluations handled while visiting, and serialize time does not
+// include writes.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    Stats* _stats;
+    Phase _phase;
+    PhaseTimer* _parent = nullptr;
+    std::chrono::steady_clock::time_point _wallStart;
+    double _cpuStart = 0;
+    double _childWallMs = 0;
+    double _childCpuMs = 0;
+};
+
+// Tracks dumpType calls and recursion depth while in scope.
+class DumpTypeCounter {
+public:
+    DumpTypeCounter() : _stats(Stats::current()) {
+        if (!_stats) return;
+        _stats->dumpTypeCalls++;
+        if (++_stats->dumpTypeDepth > _stats->maxDumpTypeDepth) {
+            _stats->maxDumpTypeDepth = _stats->dumpTypeDepth;
+        }
+    }
+
+    ~DumpTypeCounter() {
+        if (_stats) _stats->dumpTypeDepth--;
+    }
+
+private:
+    Stats* _stats;
+};
@@ -0,0 +1,373 @@
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "abi.h"
+#include "bindgen.h"
+#include "cache.h"
+#include "exports.h"
+#include "output.h"
+
+// Runs every test and exits non-zero when one of them fails. Headers are handed to libclang as unsaved files, and the
+// few tests that need files on disk write them to a temporary directory, so there are no fixtures.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+Options headerOptions(const std::string& path, const std::string& contents) {
+    Options options;
+    options.jobs = 1;
+    options.headers = {path};
+    options.unsavedFiles.push_back({path, contents});
+    return options;
+}
+
+// Extracts and merges the options' inputs the way main does, or streams them into sink when it is given.
+json extract(const Options& options, OutputSink* sink = nullptr) {
+    TypeTable types;
+    FileTable files;
+    std::unique_ptr<StreamWriter> stream;
+    if (sink) stream = std::make_unique<StreamWriter>(*sink, options.format);
+
+    json out;
+    for (auto& result : extractHeaders(options, nullptr, stream.get(), &types, &files)) {
+        check(result.ok, "extracting: " + result.diagnostics);
+        if (stream) continue;
+        mergeTypes(types, result.info);
+        mergeFiles(files, result.info);
+        mergeInfo(out, result.info);
+    }
+
+    if (stream) {
+        if (options.typeTable) stream->emitSection("types", types.entries);
+        if (options.fileTable) stream->emitSection("files", files.entries);
+        stream->finish();
+        return json();
+    }
+    if (options.typeTable) out["types"] = std::move(types.entries);
+    if (options.fileTable) out["files"] = std::move(files.entries);
+    return out;
+}
+
+// The encoded value, with the sink's error in error.
+std::string encode(const json& value, OutputFormat format, int& error) {
+    std::string bytes;
+    {
+        OutputSink sink(bytes);
+        writeValue(sink, value, format);
+        error = sink.error();
+    }
+    return bytes;
+}
+
+std::string encode(const json& value, OutputFormat format) {
+    int error;
+    auto bytes = encode(value, format, error);
+    check(error == 0, std::string("encoding ") + outputExtension(format));
+    return bytes;
+}
+
+json decode(const std::string& bytes, OutputFormat format) {
+    switch (format) {
+        case OutputFormat::Json: return json::parse(bytes, nullptr, false);
+        case OutputFormat::Cbor: return json::from_cbor(bytes, true, false);
+        case OutputFormat::MsgPack: return json::from_msgpack(bytes, true, false);
+        case OutputFormat::UBJson: return json::from_ubjson(bytes, true, false);
+        case OutputFormat::Bson: return json::from_bson(bytes, true, false);
+    }
+    return json();
+}
+
+// The value of constants[name], or null when it was not emitted.
+json constantValue(const json& out, const std::string& name) {
+    auto constants = out.find("constants");
+    if (constants == out.end() || constants->count(name) == 0) return json();
+    return (*constants)[name]["value"];
+}
+
+const char* formatsHeader = R"(
+#define LIMIT 4096
+#define RATIO 0.75
+#define NAME "widget"
+#define ALL 0xffffffffffffffffULL
+enum Color { Red = -1, Green, Blue = 0x7fffffff };
+typedef unsigned long long Big;
+struct Point { int x, y; double weight; unsigned flags : 3; char name[16]; };
+struct Point* makePoint(const char* name, Big id, ...);
+static const long long minimum = -9223372036854775807LL - 1;
+)";
+
+// Every --format decodes with nlohmann's loader to the same document the json output parses to, streamed or not.
+void testFormatsRoundTrip() {
+    for (bool tables : {false, true}) {
+        auto options = headerOptions("formats.h", formatsHeader);
+        options.macros = true;
+        options.typeTable = tables;
+        options.fileTable = tables;
+        auto out = extract(options);
+        auto expected = decode(encode(out, OutputFormat::Json), OutputFormat::Json);
+        check(expected == out, "json output parses back to the extracted document");
+        check(expected.count("structs") != 0 && expected.count("constants") != 0, "formats.h has declarations");
+
+        for (auto format : {OutputFormat::Cbor, OutputFormat::MsgPack}) {
+            auto name = std::string(outputExtension(format)) + (tables ? " with tables" : "");
+            check(decode(encode(out, format), format) == expected, name + " decodes to the json output");
+        }
+
+        // UBJSON and BSON cannot hold ALL, and fail the sink rather than throw; everything else round trips.
+        check(constantValue(out, "ALL") == 0xffffffffffffffffULL, "ALL is an unsigned constant");
+        auto representable = expected;
+        representable["constants"].erase("ALL");
+        for (auto format : {OutputFormat::UBJson, OutputFormat::Bson}) {
+            auto name = std::string(outputExtension(format)) + (tables ? " with tables" : "");
+            int error;
+            encode(out, format, error);
+            check(error == EOVERFLOW, name + " fails with EOVERFLOW on ALL");
+            auto decoded = decode(encode(representable, format), format);
+            check(decoded == representable, name + " decodes to the json output without ALL");
+        }
+
+        for (auto format : {OutputFormat::Json, OutputFormat::Cbor}) {
+            std::string streamed;
+            {
+                OutputSink sink(streamed);
+                options.format = format;
+                options.stream = true;
+                extract(options, &sink);
+            }
+            auto name = std::string("streamed ") + outputExtension(format) + (tables ? " with tables" : "");
+            check(decode(streamed, format) == expected, name + " decodes to the json output");
+        }
+    }
+}
+
+// A declaration without an initializer does not get to claim a constant ahead of its definition.
+void testExternConstBeforeDefinition() {
+    auto out = extract(headerOptions("extern.h", "extern const int answer;\nconst int answer = 42;\n"));
+    check(constantValue(out, "answer") == 42, "extern declaration then definition in one unit emits the constant");
+
+    // Across a compilation database, whichever unit is extracted first must not matter either.
+    char dir[] = "/tmp/nativebindgen_tests_XXXXXX";
+    check(mkdtemp(dir) != nullptr, "creating a temporary directory");
+    std::ofstream(std::string(dir) + "/declares.c") << "extern const int answer;\nint useAnswer(void);\n";
+    std::ofstream(std::string(dir) + "/defines.c") << "const int answer = 42;\n";
+
+    std::vector<std::vector<std::string>> orders = {{"declares.c", "defines.c"}, {"defines.c", "declares.c"}};
+    for (auto& order : orders) {
+        json commands = json::array();
+        for (auto& file : order) {
+            json command;
+            command["directory"] = dir;
+            command["file"] = file;
+            command["command"] = "cc -c " + file;
+            commands.push_back(std::move(command));
+        }
+        std::ofstream(std::string(dir) + "/compile_commands.json") << commands.dump();
+
+        Options options;
+        options.jobs = 1;
+        options.compdbDir = dir;
+        auto out = extract(options);
+        auto what = "compdb units " + order[0] + " then " + order[1] + " emit the constant";
+        check(constantValue(out, "answer") == 42, what);
+    }
+
+    for (auto file : {"declares.c", "defines.c", "compile_commands.json"}) {
+        unlink((std::string(dir) + "/" + file).c_str());
+    }
+    rmdir(dir);
+}
+
+
+// A const that comes from a typedef still makes a constant.
+void testTypedefConst() {
+    auto out = extract(headerOptions("typedefconst.h", "typedef const int cint;\nstatic cint K = 5;\n"));
+    check(constantValue(out, "K") == 5, "a typedef const variable emits the constant");
+}
+
+// An umbrella header that only includes its API headers still gets their macros as constants.
+void testUmbrellaMacros() {
+    auto options = headerOptions("umbrella.h", "#include \"api.h\"\n");
+    options.unsavedFiles.push_back({"api.h", "#define API_VERSION 3\n#define API_MASK (1 << 4)\n"});
+    options.macros = true;
+    auto out = extract(options);
+    check(constantValue(out, "API_VERSION") == 3, "a literal macro of an included header is emitted");
+    check(constantValue(out, "API_MASK") == 16, "an evaluated macro of an included header is emitted");
+}
+
+
+// Anonymous members are unnamed fields referencing a record emitted under a synthetic name, and a named member of an
+// unnamed struct type stays a single field.
+void testAnonymousMembers() {
+    auto header = "struct S { int tag; union { int i; float f; }; struct { int a; } m; };\n";
+    auto out = extract(headerOptions("anonymous.h", header));
+    auto& structs = out["structs"];
+    check(structs.count("struct S") != 0, "struct S is emitted");
+    if (structs.count("struct S") == 0) return;
+
+    auto& fields = structs["struct S"]["fields"];
+    check(fields.size() == 3, "struct S has tag, the anonymous union and m");
+    if (fields.size() != 3) return;
+    check(fields[1]["name"] == "" && fields[1]["offset"] == 4, "the anonymous union is an unnamed field at offset 4");
+    auto& type = fields[1]["type"];
+    check(type["kind"] == "Union", "the anonymous union is referenced as a Union");
+    auto record = structs.find(type.value("name", std::string()));
+    check(record != structs.end(), "the anonymous union's record is emitted");
+    if (record == structs.end()) return;
+    check(record->value("union", false) && (*record)["fields"].size() == 2, "the union record holds i and f");
+    check(fields[2]["name"] == "m", "m is a named field");
+}
+
+
+// Records the ABI tests pass around, as the extractor emits them.
+const char* abiStructs = R"({
+    "struct Pair": {"size": 16, "align": 8, "fields": [
+        {"size": 8, "align": 8, "offset": 0, "name": "x", "type": {"kind": "Primitive", "name": "double"}},
+        {"size": 8, "align": 8, "offset": 8, "name": "y", "type": {"kind": "Primitive", "name": "double"}}]},
+    "struct Triple": {"size": 24, "align": 8, "fields": [
+        {"size": 8, "align": 8, "offset": 0, "name": "a", "type": {"kind": "Primitive", "name": "signed long"}},
+        {"size": 8, "align": 8, "offset": 8, "name": "b", "type": {"kind": "Primitive", "name": "signed long"}},
+        {"size": 8, "align": 8, "offset": 16, "name": "c", "type": {"kind": "Primitive", "name": "signed long"}}]},
+    "struct Rgb": {"size": 12, "align": 4, "fields": [
+        {"size": 4, "align": 4, "offset": 0, "name": "r", "type": {"kind": "Primitive", "name": "float"}},
+        {"size": 4, "align": 4, "offset": 4, "name": "g", "type": {"kind": "Primitive", "name": "float"}},
+        {"size": 4, "align": 4, "offset": 8, "name": "b", "type": {"kind": "Primitive", "name": "float"}}]}
+})";
+
+struct AbiCase {
+    const char* what;
+    const char* triple;
+    const char* function;
+    const char* abi;
+};
+
+const AbiCase abiCases[] = {
+    {"{double, double} is two SSE eightbytes", "x86_64-unknown-linux-gnu",
+     R"({"returnType": {"kind": "Struct", "name": "struct Pair"}, "argTypes": []})",
+     R"({"convention": "sysv-x86-64", "return": {"class": ["SSE", "SSE"]}, "args": []})"},
+    {"long double is returned in x87 registers", "x86_64-unknown-linux-gnu",
+     R"({"returnType": {"kind": "Primitive", "name": "long double"},
+         "argTypes": [{"kind": "Primitive", "name": "long double"}]})",
+     R"({"convention": "sysv-x86-64", "return": {"class": ["X87", "X87UP"]}, "args": [{"class": ["MEMORY"]}]})"},
+    {"a 24-byte struct goes through memory and sret", "x86_64-unknown-linux-gnu",
+     R"({"returnType": {"kind": "Struct", "name": "struct Triple"},
+         "argTypes": [{"kind": "Struct", "name": "struct Triple"}]})",
+     R"({"convention": "sysv-x86-64", "return": {"class": ["MEMORY"]}, "sret": true,
+         "args": [{"class": ["MEMORY"]}]})"},
+    {"_Complex long double is COMPLEX_X87", "x86_64-unknown-linux-gnu",
+     R"({"returnType": {"kind": "Complex", "elementType": {"kind": "Primitive", "name": "long double"}},
+         "argTypes": []})",
+     R"({"convention": "sysv-x86-64", "return": {"class": ["COMPLEX_X87"]}, "args": []})"},
+    {"an AAPCS64 HFA takes a register per member", "aarch64-unknown-linux-gnu",
+     R"({"returnType": {"kind": "Struct", "name": "struct Rgb"},
+         "argTypes": [{"kind": "Struct", "name": "struct Rgb"}, {"kind": "Struct", "name": "struct Triple"}]})",
+     R"({"convention": "aapcs64", "return": {"class": ["SSE", "SSE", "SSE"]},
+         "args": [{"class": ["SSE", "SSE", "SSE"]}, {"class": ["MEMORY"], "byReference": true}]})"},
+    {"Apple arm64 passes varargs on the stack and long double as double", "arm64-apple-macosx11.0",
+     R"({"returnType": {"kind": "Primitive", "name": "long double"},
+         "argTypes": [{"kind": "Primitive", "name": "signed int"}], "varadic": true})",
+     R"({"convention": "aapcs64-darwin", "return": {"class": ["SSE"]}, "args": [{"class": ["INTEGER"]}],
+         "varargs": true, "varargsOnStack": true})"},
+};
+
+// classifyCalls is pure json to json, so it is tested on hand-written output rather than extracted headers.
+void testAbiClassification() {
+    for (auto& abiCase : abiCases) {
+        json out;
+        out["structs"] = json::parse(abiStructs);
+        out["vars"]["f"] = json::parse(abiCase.function);
+        size_t unclassified = 0;
+        check(classifyCalls(out, abiCase.triple, unclassified) && unclassified == 0,
+              std::string("classifying: ") + abiCase.what);
+        check(out["vars"]["f"]["abi"] == json::parse(abiCase.abi), abiCase.what);
+    }
+
+    json out;
+    size_t unclassified;
+    check(!classifyCalls(out, "i686-pc-linux-gnu", unclassified), "i686 is not classified");
+    check(!classifyCalls(out, "aarch64-pc-windows-msvc", unclassified), "AArch64 Windows is not classified");
+
+    std::string triple;
+    out["targets"]["x86_64-unknown-linux-gnu"] = {{"pointerWidth", 64}};
+    check(abiTarget(out, triple) && triple == "x86_64-unknown-linux-gnu", "the recorded target is classified for");
+    out["targets"]["i386-pc-linux-gnu"] = {{"pointerWidth", 32}};
+    check(!abiTarget(out, triple), "units parsed for different targets are not classified");
+}
+
+
+// The .gnu.hash lookup and the version tables, on the system's libc, where memcpy has had a second version since glibc
+// 2.14 on x86-64.
+void testLibcExports() {
+    std::unique_ptr<ElfExports> libc;
+    for (auto path : {"/lib/x86_64-linux-gnu/libc.so.6", "/lib/aarch64-linux-gnu/libc.so.6", "/lib64/libc.so.6",
+                      "/usr/lib64/libc.so.6", "/usr/lib/libc.so.6"}) {
+        std::string error;
+        if (access(path, R_OK) == 0 && (libc = ElfExports::load(path, error))) break;
+    }
+    check(libc != nullptr, "loading libc.so.6");
+    if (!libc) return;
+
+    std::string version;
+    check(libc->find("memcpy", version), "libc exports memcpy");
+#if defined(__x86_64__)
+    check(version == "GLIBC_2.14", "memcpy's default version is GLIBC_2.14, not " + version);
+#else
+    check(version.rfind("GLIBC_", 0) == 0, "memcpy is versioned, not " + version);
+#endif
+    check(!libc->find("nativebindgen_not_in_libc", version), "libc does not export a made up name");
+}
+
+// Eviction leaves another process's in-flight temporary files alone, but clears the ones a dead run left behind.
+void testCacheEvictionTempFiles() {
+    char dir[] = "/tmp/nativebindgen_tests_XXXXXX";
+    check(mkdtemp(dir) != nullptr, "creating a temporary directory");
+    auto entry = std::string(dir) + "/r-0000000000000001";
+    auto writing = entry + ".tmp.1.2";
+    auto abandoned = std::string(dir) + "/m-0000000000000002.tmp.3.4";
+    for (auto& path : {entry, writing, abandoned}) {
+        std::ofstream(path) << std::string(100, 'x');
+    }
+    struct timespec old[2] = {{time(nullptr) - 2 * 60 * 60, 0}, {time(nullptr) - 2 * 60 * 60, 0}};
+    utimensat(AT_FDCWD, abandoned.c_str(), old, 0);
+
+    ResultCache(dir, 10, "").evict();
+    check(access(entry.c_str(), F_OK) != 0, "eviction deletes entries over the cap");
+    check(access(writing.c_str(), F_OK) == 0, "eviction keeps a temporary file still being written");
+    check(access(abandoned.c_str(), F_OK) != 0, "eviction deletes an abandoned temporary file");
+
+    for (auto& path : {entry, writing, abandoned, std::string(dir) + "/lock"}) {
+        unlink(path.c_str());
+    }
+    rmdir(dir);
+}
+
+}
+
+int main() {
+    testFormatsRoundTrip();
+    testExternConstBeforeDefinition();
+    testTypedefConst();
+    testUmbrellaMacros();
+    testAnonymousMembers();
+    testAbiClassification();
+    testLibcExports();
+    testCacheEvictionTempFiles();
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
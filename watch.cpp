@@ -0,0 +1,368 @@
+#include "watch.h"
+#include "output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+
+namespace {
+
+// Editors save in several steps (truncate and write, or write a copy and rename it over), which should trigger a single
+// re-extraction.
+constexpr int settleMillis = 50;
+
+constexpr uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+// A file the unit included, along with the files that include it, innermost first.
+struct Inclusion {
+    std::string path;
+    std::vector<std::string> includers;
+};
+
+void inclusionVisitor(CXFile file, CXSourceLocation* stack, unsigned depth, CXClientData client_data) {
+    auto& inclusions = *reinterpret_cast<std::vector<Inclusion>*>(client_data);
+    Inclusion inclusion{ClangString(clang_getFileName(file)).str(), {}};
+    for (unsigned i = 0; i < depth; i++) {
+        CXFile includer;
+        clang_getFileLocation(stack[i], &includer, nullptr, nullptr, nullptr);
+        inclusion.includers.push_back(ClangString(clang_getFileName(includer)).str());
+    }
+    inclusions.push_back(std::move(inclusion));
+}
+
+std::string realPath(const std::string& path) {
+    char* resolved = realpath(path.c_str(), nullptr);
+    if (!resolved) return path;
+    std::string result(resolved);
+    free(resolved);
+    return result;
+}
+
+std::string dirName(const std::string& path) {
+    auto slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    if (slash == 0) return "/";
+    return path.substr(0, slash);
+}
+
+struct WatchedUnit {
+    std::string header;
+    CXTranslationUnit unit = nullptr;
+    std::vector<Inclusion> inclusions;
+    json info;
+};
+
+// The file a srcRef points into, whether it names it or indexes the file table.
+std::string srcRefFile(const json& info, const json& srcRef) {
+    if (srcRef.is_array()) {
+        return info.at("files").at(srcRef[0].get<size_t>()).get<std::string>();
+    }
+    return srcRef.at("fileName").get<std::string>();
+}
+
+// The declaration a structs entry belongs to: the records of anonymous members, which have no srcRef of their own, go
+// with the record holding them.
+std::string owningDeclaration(const std::string& name) {
+    auto anonymous = std::min(name.find("::(anonymous struct "), name.find("::(anonymous union "));
+    return anonymous == std::string::npos ? name : name.substr(0, anonymous);
+}
+
+// Removes every declaration whose srcRef points into one of files.
+void dropDeclarations(json& info, const std::unordered_set<std::string>& files) {
+    auto srcRefs = info.find("srcRefs");
+    if (srcRefs == info.end()) return;
+
+    std::unordered_set<std::string> dropped;
+    for (auto& srcRef : srcRefs->items()) {
+        if (files.count(srcRefFile(info, srcRef.value())) != 0) {
+            dropped.insert(srcRef.key());
+        }
+    }
+    if (dropped.empty()) return;
+
+    // Each section is rebuilt in one pass: erasing names one at a time shifts and reindexes the rest every time, which
+    // is quadratic when an edit to the main header drops everything.
+    for (auto& section : {"structs", "vars", "constants", "srcRefs"}) {
+        auto it = info.find(section);
+        if (it == info.end()) continue;
+        json kept = json::object();
+        for (auto& entry : it->items()) {
+            if (dropped.count(owningDeclaration(entry.key())) == 0) kept[entry.key()] = std::move(entry.value());
+        }
+        *it = std::move(kept);
+    }
+}
+
+class Watcher {
+public:
+    Watcher(const Options& options, std::string outPath)
+        : _options(options), _outPath(std::move(outPath)), _index(clang_createIndex(0, 0)),
+          _inotify(inotify_init1(IN_CLOEXEC)) {}
+
+    ~Watcher() {
+        for (auto& unit : _units) {
+            if (unit.unit) clang_disposeTranslationUnit(unit.unit);
+        }
+        clang_disposeIndex(_index);
+        if (_inotify >= 0) close(_inotify);
+    }
+
+    int run();
+
+private:
+    bool load(WatchedUnit& unit);
+    void update(WatchedUnit& unit, const std::unordered_set<std::string>& changed);
+    void collectInclusions(WatchedUnit& unit);
+    void subscribe(const WatchedUnit& unit);
+    bool waitForChanges(std::unordered_set<std::string>& changed);
+    bool publish();
+
+    const Options& _options;
+    std::string _outPath;
+    CXIndex _index;
+    int _inotify;
+    std::vector<WatchedUnit> _units;
+
+    // Watches are put on directories rather than files, so they survive editors replacing a file with a new one.
+    std::unordered_map<int, std::string> _dirs;
+
+    // Resolved path of every included file, to the names libclang knows it by.
+    std::unordered_map<std::string, std::vector<std::string>> _files;
+};
+
+bool Watcher::load(WatchedUnit& unit) {
+    std::string error;
+    unit.unit = parseWarmUnit(_index, unit.header, _options.clangArgs, _options, error);
+    if (!unit.unit) {
+        cerr << error << endl;
+        unit.info = json();
+        return false;
+    }
+
+    auto result = extractUnit(unit.unit, _options, _options.clangArgs);
+    cerr << result.diagnostics;
+    unit.info = std::move(result.info);
+    collectInclusions(unit);
+    return true;
+}
+
+void Watcher::update(WatchedUnit& unit, const std::unordered_set<std::string>& changed) {
+    if (!unit.unit) {
+        load(unit);
+        return;
+    }
+
+    // Declarations read after the first changed file may depend on any macro or type it defines, and the files
+    // including a changed file continue after the #include with whatever it declared.
+    std::unordered_set<std::string> affected;
+    bool after = false;
+    for (auto& inclusion : unit.inclusions) {
+        if (changed.count(inclusion.path) != 0) {
+            after = true;
+            affected.insert(inclusion.includers.begin(), inclusion.includers.end());
+        }
+        if (after) affected.insert(inclusion.path);
+    }
+
+    if (clang_reparseTranslationUnit(unit.unit, 0, nullptr, clang_defaultReparseOptions(unit.unit)) != 0) {
+        // A failed reparse leaves the unit unusable; start over from a fresh parse.
+        clang_disposeTranslationUnit(unit.unit);
+        unit.unit = nullptr;
+        load(unit);
+        return;
+    }
+
+    dropDeclarations(unit.info, affected);
+    auto result = extractUnit(unit.unit, _options, _options.clangArgs, &affected);
+    cerr << result.diagnostics;
+
+    // Typedefs carry no srcRef; the re-extracted declarations bring fresh copies of the ones they reference.
+    auto typedefs = result.info.find("typedefs");
+    auto oldTypedefs = unit.info.find("typedefs");
+    if (typedefs != result.info.end() && oldTypedefs != unit.info.end()) {
+        for (auto& entry : typedefs->items()) oldTypedefs->erase(entry.key());
+    }
+
+    TypeTable types;
+    FileTable files;
+    mergeTypes(types, unit.info);
+    mergeTypes(types, result.info);
+    mergeFiles(files, unit.info);
+    mergeFiles(files, result.info);
+    mergeInfo(unit.info, result.info);
+    if (_options.typeTable) {
+        unit.info["types"] = std::move(types.entries);
+    }
+    if (_options.fileTable) {
+        unit.info["files"] = std::move(files.entries);
+    }
+    compactTables(unit.info);
+    collectInclusions(unit);
+}
+
+void Watcher::collectInclusions(WatchedUnit& unit) {
+    unit.inclusions.clear();
+    clang_getInclusions(unit.unit, inclusionVisitor, reinterpret_cast<CXClientData>(&unit.inclusions));
+}
+
+void Watcher::subscribe(const WatchedUnit& unit) {
+    auto subscribeFile = [&](const std::string& path) {
+        auto resolved = realPath(path);
+        auto& names = _files[resolved];
+        if (std::find(names.begin(), names.end(), path) == names.end()) {
+            names.push_back(path);
+        }
+
+        auto dir = dirName(resolved);
+        int wd = inotify_add_watch(_inotify, dir.c_str(), watchMask | IN_ONLYDIR);
+        if (wd >= 0) {
+            _dirs[wd] = dir;
+        }
+    };
+
+    subscribeFile(unit.header);
+    for (auto& inclusion : unit.inclusions) {
+        subscribeFile(inclusion.path);
+    }
+}
+
+bool Watcher::waitForChanges(std::unordered_set<std::string>& changed) {
+    alignas(inotify_event) char buffer[16 * 1024];
+    int timeout = -1;
+    while (!stopRequested) {
+        pollfd pfd{_inotify, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ready == 0) return true;
+
+        auto n = read(_inotify, buffer, sizeof(buffer));
+        if (n <= 0) continue;
+        for (char* p = buffer; p < buffer + n;) {
+            auto event = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            auto dir = _dirs.find(event->wd);
+            if (dir == _dirs.end() || event->len == 0) continue;
+            auto file = _files.find(dir->second + (dir->second == "/" ? "" : "/") + event->name);
+            if (file == _files.end()) continue;
+            changed.insert(file->second.begin(), file->second.end());
+        }
+
+        // Keep draining until the burst of events settles.
+        if (!changed.empty()) timeout = settleMillis;
+    }
+    return false;
+}
+
+bool Watcher::publish() {
+    json out;
+    TypeTable types;
+    FileTable files;
+    for (auto& unit : _units) {
+        json info = unit.info;
+        mergeTypes(types, info);
+        mergeFiles(files, info);
+        mergeInfo(out, info);
+    }
+    if (_options.typeTable) {
+        out["types"] = std::move(types.entries);
+    }
+    if (_options.fileTable) {
+        out["files"] = std::move(files.entries);
+    }
+
+    auto tmpPath = _outPath + ".tmp." + std::to_string(getpid());
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Unable to open " << tmpPath << endl;
+        return false;
+    }
+
+    int writeError;
+    {
+        OutputSink sink({fd});
+        writeValue(sink, out, _options.format);
+        if (_options.format == OutputFormat::Json) {
+            sink.put('\n');
+        }
+        sink.flush();
+        writeError = sink.error();
+    }
+    if (close(fd) != 0 && writeError == 0) writeError = errno;
+    // A partial output never replaces the previous complete one.
+    if (writeError != 0) {
+        cerr << "Unable to write " << _outPath << ": " << strerror(writeError) << endl;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return rename(tmpPath.c_str(), _outPath.c_str()) == 0;
+}
+
+int Watcher::run() {
+    if (_inotify < 0) {
+        cerr << "Unable to initialize inotify: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    for (auto& header : _options.headers) {
+        _units.push_back({header});
+    }
+    for (auto& unit : _units) {
+        if (!load(unit)) return -1;
+        subscribe(unit);
+    }
+    if (!publish()) return -1;
+    cerr << "Wrote " << _outPath << ", watching " << _files.size() << " files" << endl;
+
+    std::unordered_set<std::string> changed;
+    while (waitForChanges(changed)) {
+        for (auto& unit : _units) {
+            bool includesChanged = changed.count(unit.header) != 0;
+            for (auto& inclusion : unit.inclusions) {
+                includesChanged = includesChanged || changed.count(inclusion.path) != 0;
+            }
+            if (!includesChanged) continue;
+
+            update(unit, changed);
+            subscribe(unit);
+        }
+        changed.clear();
+
+        if (publish()) {
+            cerr << "Updated " << _outPath << endl;
+        }
+    }
+    return 0;
+}
+
+}
+
+int watch(const Options& options, const std::string& outPath) {
+    // No SA_RESTART, so a signal interrupts poll and the loop gets to check stopRequested.
+    struct sigaction action{};
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Watcher watcher(options, outPath);
+    return watcher.run();
+}
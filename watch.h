@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include "bindgen.h"
+
+// Extracts options.headers into outPath, then keeps their translation units parsed and rewrites outPath whenever a
+// file they include changes. Only the declarations that can depend on the edit are extracted again: those of the
+// changed files, of every file included after them and of the files including them. Returns once SIGINT or SIGTERM
+// arrives.
+int watch(const Options& options, const std::string& outPath);